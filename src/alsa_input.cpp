@@ -2,15 +2,81 @@
 
 #include "alsa_input.h"
 #include "synth.h"
+#include "trace.h"
+#include "thread_policy.h"
+#include "midi_event.h"
 #include <alsa/asoundlib.h>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <vector>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 struct AlsaInput::Impl {
     snd_seq_t* seq = nullptr;
-    int port = -1;
+    std::vector<int> ports;     // Port ids, in channel block order
+    int portBlock[256];         // Port id -> channel block (-1 = not ours)
     int client = -1;
+    int queue = -1;             // Stamps incoming events in real time
+    int wakeFds[2] = {-1, -1};  // Self-pipe to interrupt poll() on stop()
 };
 
+// Translate a sequencer event into a channel message (false if unsupported)
+static bool decodeEvent(const snd_seq_event_t* ev, MidiEvent& out) {
+    out.time = 0.0;
+    out.param2 = 0;
+
+    switch (ev->type) {
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF:
+            out.type = ev->type == SND_SEQ_EVENT_NOTEON ? MIDI_NOTE_ON : MIDI_NOTE_OFF;
+            out.channel = ev->data.note.channel;
+            out.param1 = ev->data.note.note & 0x7F;
+            out.param2 = ev->data.note.velocity & 0x7F;
+            return true;
+
+        case SND_SEQ_EVENT_CONTROLLER:
+            out.type = MIDI_CONTROL_CHANGE;
+            out.channel = ev->data.control.channel;
+            out.param1 = ev->data.control.param & 0x7F;
+            out.param2 = ev->data.control.value & 0x7F;
+            return true;
+
+        case SND_SEQ_EVENT_CONTROL14:
+            // 14-bit controller, keep the coarse part
+            out.type = MIDI_CONTROL_CHANGE;
+            out.channel = ev->data.control.channel;
+            out.param1 = ev->data.control.param & 0x7F;
+            out.param2 = (ev->data.control.value >> 7) & 0x7F;
+            return true;
+
+        case SND_SEQ_EVENT_PGMCHANGE:
+            out.type = MIDI_PROGRAM_CHANGE;
+            out.channel = ev->data.control.channel;
+            out.param1 = ev->data.control.value & 0x7F;
+            return true;
+
+        case SND_SEQ_EVENT_PITCHBEND: {
+            // ALSA pitch bend is -8192 to 8191, convert to 0-16383
+            int value = ev->data.control.value + 8192;
+            if (value < 0) value = 0;
+            if (value > 16383) value = 16383;
+            out.type = MIDI_PITCH_BEND;
+            out.channel = ev->data.control.channel;
+            out.param1 = value & 0x7F;
+            out.param2 = value >> 7;
+            return true;
+        }
+
+        default:
+            // Ignore other event types
+            return false;
+    }
+}
+
 AlsaInput::AlsaInput(Synthesizer& synth)
     : synth_(synth), impl_(new Impl) {
 }
@@ -20,13 +86,18 @@ AlsaInput::~AlsaInput() {
     delete impl_;
 }
 
-bool AlsaInput::start(const std::string& clientName, QuitCallback onQuit) {
+bool AlsaInput::start(const std::string& clientName, QuitCallback onQuit, int ports) {
     if (running_.load()) {
         return false;
     }
 
-    // Open ALSA sequencer
-    int err = snd_seq_open(&impl_->seq, "default", SND_SEQ_OPEN_INPUT, 0);
+    if (ports < 1 || ports > MAX_PORTS) {
+        std::fprintf(stderr, "Port count must be between 1 and %d\n", MAX_PORTS);
+        return false;
+    }
+
+    // Open ALSA sequencer (output too, to start our queue)
+    int err = snd_seq_open(&impl_->seq, "default", SND_SEQ_OPEN_DUPLEX, 0);
     if (err < 0) {
         std::fprintf(stderr, "Failed to open ALSA sequencer: %s\n", snd_strerror(err));
         return false;
@@ -43,23 +114,68 @@ bool AlsaInput::start(const std::string& clientName, QuitCallback onQuit) {
 
     impl_->client = snd_seq_client_id(impl_->seq);
 
-    // Create input port
-    impl_->port = snd_seq_create_simple_port(
-        impl_->seq,
-        "MIDI In",
-        SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-        SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_SYNTHESIZER | SND_SEQ_PORT_TYPE_APPLICATION
-    );
+    // Queue used to timestamp everything delivered to our port. Clients can
+    // also schedule events ahead on it (it is named after the client).
+    impl_->queue = snd_seq_alloc_named_queue(impl_->seq, clientName.c_str());
+    if (impl_->queue < 0) {
+        std::fprintf(stderr, "Failed to create ALSA queue: %s\n", snd_strerror(impl_->queue));
+        snd_seq_close(impl_->seq);
+        impl_->seq = nullptr;
+        return false;
+    }
 
-    if (impl_->port < 0) {
-        std::fprintf(stderr, "Failed to create ALSA port: %s\n", snd_strerror(impl_->port));
+    // Create input ports, stamped with real time from our queue.
+    // Port k feeds synth channels 16*k .. 16*k+15.
+    impl_->ports.clear();
+    std::fill(std::begin(impl_->portBlock), std::end(impl_->portBlock), -1);
+    for (int k = 0; k < ports; ++k) {
+        std::string name = ports == 1 ? "MIDI In" : "MIDI In " + std::to_string(k + 1);
+
+        snd_seq_port_info_t* info;
+        snd_seq_port_info_alloca(&info);
+        snd_seq_port_info_set_name(info, name.c_str());
+        snd_seq_port_info_set_capability(info, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+        snd_seq_port_info_set_type(info, SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+                                         SND_SEQ_PORT_TYPE_SYNTHESIZER | SND_SEQ_PORT_TYPE_APPLICATION);
+        snd_seq_port_info_set_midi_channels(info, 16);
+        snd_seq_port_info_set_timestamping(info, 1);
+        snd_seq_port_info_set_timestamp_real(info, 1);
+        snd_seq_port_info_set_timestamp_queue(info, impl_->queue);
+
+        err = snd_seq_create_port(impl_->seq, info);
+        if (err < 0) {
+            std::fprintf(stderr, "Failed to create ALSA port: %s\n", snd_strerror(err));
+            snd_seq_close(impl_->seq);
+            impl_->seq = nullptr;
+            return false;
+        }
+        int port = snd_seq_port_info_get_port(info);
+        impl_->ports.push_back(port);
+        impl_->portBlock[port & 0xFF] = k;
+    }
+
+    snd_seq_start_queue(impl_->seq, impl_->queue, nullptr);
+    snd_seq_drain_output(impl_->seq);
+
+    // Non-blocking, so the input loop can drain and then wait in poll()
+    snd_seq_nonblock(impl_->seq, 1);
+
+    if (pipe(impl_->wakeFds) < 0) {
+        std::fprintf(stderr, "Failed to create wake pipe: %s\n", strerror(errno));
         snd_seq_close(impl_->seq);
         impl_->seq = nullptr;
         return false;
     }
+    for (int fd : impl_->wakeFds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
 
-    std::printf("ALSA MIDI port created: %d:%d (%s)\n", impl_->client, impl_->port, clientName.c_str());
-    std::printf("Connect with: aconnect <source> %d:%d\n", impl_->client, impl_->port);
+    for (size_t k = 0; k < impl_->ports.size(); ++k) {
+        std::printf("ALSA MIDI port created: %d:%d (%s, channels %zu-%zu)\n",
+                    impl_->client, impl_->ports[k], clientName.c_str(), k * 16 + 1, k * 16 + 16);
+    }
+    std::printf("Connect with: aconnect <source> %d:%d\n", impl_->client, impl_->ports[0]);
 
     quitCallback_ = std::move(onQuit);
     running_.store(true);
@@ -71,12 +187,13 @@ bool AlsaInput::start(const std::string& clientName, QuitCallback onQuit) {
 void AlsaInput::stop() {
     running_.store(false);
 
+    // Wake the input thread out of poll()
+    if (impl_->wakeFds[1] >= 0) {
+        char c = 0;
+        (void)!write(impl_->wakeFds[1], &c, 1);
+    }
+
     if (inputThread_.joinable()) {
-        // Wake up the blocking read by closing the sequencer
-        if (impl_->seq) {
-            snd_seq_close(impl_->seq);
-            impl_->seq = nullptr;
-        }
         inputThread_.join();
     }
 
@@ -84,71 +201,105 @@ void AlsaInput::stop() {
         snd_seq_close(impl_->seq);
         impl_->seq = nullptr;
     }
+
+    for (int& fd : impl_->wakeFds) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
 }
 
 std::string AlsaInput::getPortName() const {
-    if (impl_->client >= 0 && impl_->port >= 0) {
-        return std::to_string(impl_->client) + ":" + std::to_string(impl_->port);
+    if (impl_->client >= 0 && !impl_->ports.empty()) {
+        return std::to_string(impl_->client) + ":" + std::to_string(impl_->ports[0]);
     }
     return "";
 }
 
 void AlsaInput::inputLoop() {
-    snd_seq_event_t* ev;
+    // Wake pipe first, then the sequencer's own descriptors
+    int seqCount = snd_seq_poll_descriptors_count(impl_->seq, POLLIN);
+    std::vector<struct pollfd> pfds(1 + seqCount);
+    pfds[0] = {impl_->wakeFds[0], POLLIN, 0};
+    snd_seq_poll_descriptors(impl_->seq, &pfds[1], seqCount, POLLIN);
+
+    MidiEvent batch[BATCH_SIZE];
+    snd_seq_queue_status_t* status;
+    snd_seq_queue_status_alloca(&status);
+    Trace::registerThread("alsa-input");
+    ThreadPolicy::apply(ThreadPolicy::Role::Input, "alsa-input");
 
     while (running_.load()) {
-        int err = snd_seq_event_input(impl_->seq, &ev);
-        if (err < 0) {
-            if (err == -EAGAIN) continue;
-            break;  // Error or closed
+        int ret = poll(pfds.data(), pfds.size(), -1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
         }
 
-        if (!ev) continue;
-
-        switch (ev->type) {
-            case SND_SEQ_EVENT_NOTEON:
-                if (ev->data.note.velocity > 0) {
-                    synth_.noteOn(ev->data.note.channel, ev->data.note.note,
-                                  ev->data.note.velocity / 127.0f);
-                } else {
-                    synth_.noteOff(ev->data.note.channel, ev->data.note.note);
-                }
-                break;
-
-            case SND_SEQ_EVENT_NOTEOFF:
-                synth_.noteOff(ev->data.note.channel, ev->data.note.note);
-                break;
-
-            case SND_SEQ_EVENT_CONTROLLER:
-                synth_.controlChange(ev->data.control.channel,
-                                     ev->data.control.param,
-                                     ev->data.control.value);
-                break;
-
-            case SND_SEQ_EVENT_PGMCHANGE:
-                synth_.programChange(ev->data.control.channel,
-                                     ev->data.control.value);
-                break;
-
-            case SND_SEQ_EVENT_PITCHBEND:
-                // ALSA pitch bend is -8192 to 8191, convert to 0-16383
-                synth_.pitchBend(ev->data.control.channel,
-                                 ev->data.control.value + 8192);
-                break;
-
-            case SND_SEQ_EVENT_CONTROL14:
-                // 14-bit controller
-                synth_.controlChange(ev->data.control.channel,
-                                     ev->data.control.param,
-                                     ev->data.control.value >> 7);
-                break;
+        if (pfds[0].revents) {
+            break;  // stop() requested
+        }
 
-            default:
-                // Ignore other event types
+        TraceSpan span("alsa.receive");
+        int received = 0;
+
+        // Map queue time onto the render clock once per pass. Events are
+        // placed one render block after "now", which turns block
+        // quantisation into a fixed delay with sample-accurate spacing.
+        Synthesizer::Clock clock = synth_.getClock();
+        int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        double queueNow = 0.0;
+        if (snd_seq_get_queue_status(impl_->seq, impl_->queue, status) >= 0) {
+            const snd_seq_real_time_t* rt = snd_seq_queue_status_get_real_time(status);
+            queueNow = rt->tv_sec + rt->tv_nsec * 1e-9;
+        }
+        double renderNow = clock.frame + (nowNs - clock.timeNs) * 1e-9 * clock.sampleRate;
+        double base = renderNow + clock.blockFrames;
+
+        // Drain everything queued so far and apply it in batches
+        bool failed = false;
+        int count = 0;
+        while (snd_seq_event_input_pending(impl_->seq, 1) > 0) {
+            snd_seq_event_t* ev = nullptr;
+            int err = snd_seq_event_input(impl_->seq, &ev);
+            if (err < 0) {
+                if (err == -EAGAIN) break;
+                if (err == -ENOSPC) continue;  // Input overrun, events were lost
+                failed = true;
                 break;
+            }
+
+            int block = ev ? impl_->portBlock[ev->dest.port] : -1;
+            if (block >= 0 && decodeEvent(ev, batch[count])) {
+                batch[count].channel = block * 16 + (batch[count].channel & 0x0F);
+                // Tick-stamped or unstamped events play at the next block
+                if ((ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL &&
+                    ev->queue == impl_->queue && queueNow > 0.0) {
+                    double evTime = ev->time.time.tv_sec + ev->time.time.tv_nsec * 1e-9;
+                    batch[count].time = base + (evTime - queueNow) * clock.sampleRate;
+                }
+                ++received;
+                if (++count == BATCH_SIZE) {
+                    Trace::instant("alsa.events", count);
+                    synth_.scheduleEvents(batch, count);
+                    synth_.stats().countEvents(RuntimeStats::Source::Alsa, count);
+                    count = 0;
+                }
+            }
+            snd_seq_free_event(ev);
         }
 
-        snd_seq_free_event(ev);
+        if (count > 0) {
+            Trace::instant("alsa.events", count);
+            synth_.scheduleEvents(batch, count);
+            synth_.stats().countEvents(RuntimeStats::Source::Alsa, count);
+        }
+        span.setCount(received);
+        if (failed) {
+            break;
+        }
     }
 
     running_.store(false);
@@ -168,7 +319,7 @@ struct AlsaInput::Impl {};
 AlsaInput::AlsaInput(Synthesizer& synth) : synth_(synth), impl_(nullptr) {}
 AlsaInput::~AlsaInput() {}
 
-bool AlsaInput::start(const std::string&, QuitCallback) {
+bool AlsaInput::start(const std::string&, QuitCallback, int) {
     std::fprintf(stderr, "ALSA support not compiled in\n");
     return false;
 }
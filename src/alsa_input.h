@@ -16,8 +16,10 @@ public:
     ~AlsaInput();
 
     // Start ALSA sequencer input
-    // Creates a virtual MIDI port that other apps can connect to
-    bool start(const std::string& clientName = "termux-midi", QuitCallback onQuit = nullptr);
+    // Creates virtual MIDI ports that other apps can connect to; port k
+    // drives synth channels 16*k .. 16*k+15
+    bool start(const std::string& clientName = "termux-midi", QuitCallback onQuit = nullptr,
+               int ports = 1);
 
     // Stop input handling
     void stop();
@@ -28,6 +30,12 @@ public:
     // Get the ALSA client:port string for connection info
     std::string getPortName() const;
 
+    // Events decoded per synth transaction while draining the sequencer
+    static constexpr int BATCH_SIZE = 256;
+
+    // 16 ports x 16 channels fills the MidiEvent channel range
+    static constexpr int MAX_PORTS = 16;
+
 private:
     Synthesizer& synth_;
     std::atomic<bool> running_{false};
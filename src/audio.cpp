@@ -1,8 +1,13 @@
 #include "audio.h"
+#include "trace.h"
+#include "thread_policy.h"
 #include <SLES/OpenSLES.h>
 #include <SLES/OpenSLES_Android.h>
+#include <chrono>
 #include <cstring>
 #include <cstdio>
+#include <thread>
+#include <dlfcn.h>
 
 struct AudioOutput::Impl {
     SLObjectItf engineObject = nullptr;
@@ -14,8 +19,54 @@ struct AudioOutput::Impl {
 
     // Double buffer
     int16_t buffers[NUM_BUFFERS][BUFFER_FRAMES * CHANNELS];
+
+    // Null/WAV sinks
+    Sink sink = Sink::OpenSL;
+    std::string wavPath;
+    FILE* wav = nullptr;
+    uint32_t wavFrames = 0;
+    std::thread timer;   // Stands in for the device's buffer callback
 };
 
+// Canonical 44-byte header for 16-bit PCM; more than two channels need
+// WAVE_FORMAT_EXTENSIBLE, whose fmt chunk is 24 bytes longer
+void writeWavHeader(FILE* f, uint32_t frames, int channelCount, int sampleRate) {
+    const bool extensible = channelCount > 2;
+    const uint32_t rate = static_cast<uint32_t>(sampleRate);
+    const uint16_t channels = static_cast<uint16_t>(channelCount);
+    const uint16_t align = channels * sizeof(int16_t);
+    const uint32_t byteRate = rate * align;
+    const uint32_t dataBytes = frames * align;
+    const uint32_t fmtBytes = extensible ? 40 : 16;
+    const uint32_t riffBytes = 20 + fmtBytes + dataBytes;
+    const uint16_t format = extensible ? 0xFFFE : 1;
+    const uint16_t bits = 16;
+
+    std::fwrite("RIFF", 1, 4, f);
+    std::fwrite(&riffBytes, 4, 1, f);
+    std::fwrite("WAVEfmt ", 1, 8, f);
+    std::fwrite(&fmtBytes, 4, 1, f);
+    std::fwrite(&format, 2, 1, f);
+    std::fwrite(&channels, 2, 1, f);
+    std::fwrite(&rate, 4, 1, f);
+    std::fwrite(&byteRate, 4, 1, f);
+    std::fwrite(&align, 2, 1, f);
+    std::fwrite(&bits, 2, 1, f);
+    if (extensible) {
+        // No speaker mask: the channels are stems, not surround positions
+        const uint16_t extraBytes = 22;
+        const uint32_t channelMask = 0;
+        static const uint8_t pcmGuid[16] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                                            0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+        std::fwrite(&extraBytes, 2, 1, f);
+        std::fwrite(&bits, 2, 1, f);
+        std::fwrite(&channelMask, 4, 1, f);
+        std::fwrite(pcmGuid, 1, 16, f);
+    }
+    std::fwrite("data", 1, 4, f);
+    std::fwrite(&dataBytes, 4, 1, f);
+}
+
 // File-local callback function for OpenSL ES
 static void bufferQueueCallback(SLAndroidSimpleBufferQueueItf /*bq*/, void* context) {
     auto* audio = static_cast<AudioOutput*>(context);
@@ -43,27 +94,135 @@ AudioOutput::~AudioOutput() {
 }
 
 void AudioOutput::onBufferComplete() {
+    // Buffers primed by start() are filled on the caller's thread; the
+    // trace ring and policy belong to the thread that delivers completions
+    Trace::registerThread("audio");
+    ThreadPolicy::apply(ThreadPolicy::Role::Render, "audio");
     fillBuffer(currentBuffer_);
     currentBuffer_ = (currentBuffer_ + 1) % NUM_BUFFERS;
 }
 
 void AudioOutput::fillBuffer(int bufferIndex) {
+    TraceSpan span("audio.callback", BUFFER_FRAMES);
     if (callback_) {
         callback_(impl_->buffers[bufferIndex], BUFFER_FRAMES);
     } else {
         std::memset(impl_->buffers[bufferIndex], 0, BUFFER_FRAMES * CHANNELS * sizeof(int16_t));
     }
 
-    (*impl_->bufferQueue)->Enqueue(
-        impl_->bufferQueue,
-        impl_->buffers[bufferIndex],
-        BUFFER_FRAMES * CHANNELS * sizeof(int16_t)
-    );
+    if (enqueueObserver_) {
+        int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        enqueueObserver_(impl_->buffers[bufferIndex], BUFFER_FRAMES, nowNs);
+    }
+
+    switch (impl_->sink) {
+        case Sink::OpenSL:
+            (*impl_->bufferQueue)->Enqueue(
+                impl_->bufferQueue,
+                impl_->buffers[bufferIndex],
+                BUFFER_FRAMES * CHANNELS * sizeof(int16_t)
+            );
+            break;
+
+        case Sink::Wav:
+            if (impl_->wav) {
+                std::fwrite(impl_->buffers[bufferIndex], sizeof(int16_t), BUFFER_FRAMES * CHANNELS, impl_->wav);
+                impl_->wavFrames += BUFFER_FRAMES;
+            }
+            break;
+
+        case Sink::Null:
+            break;
+    }
+}
+
+void AudioOutput::setSink(Sink sink, const std::string& wavPath) {
+    impl_->sink = sink;
+    impl_->wavPath = wavPath;
+}
+
+void AudioOutput::timerLoop() {
+    // One buffer completes per buffer period, as on a real device
+    auto period = std::chrono::nanoseconds(1000000000LL * BUFFER_FRAMES / sampleRate_);
+    auto next = std::chrono::steady_clock::now() + period;
+    while (running_.load()) {
+        std::this_thread::sleep_until(next);
+        next += period;
+        onBufferComplete();
+    }
+}
+
+void AudioOutput::closeWav() {
+    if (!impl_->wav) {
+        return;
+    }
+    // Patch the sizes now that the length is known
+    std::fseek(impl_->wav, 0, SEEK_SET);
+    writeWavHeader(impl_->wav, impl_->wavFrames, CHANNELS, sampleRate_);
+    std::fclose(impl_->wav);
+    impl_->wav = nullptr;
+}
+
+// OpenSL ES can't report the device rate. AAudio (Android 8.0+) can: a
+// low-latency stream opened without a rate gets the one the fast mixer runs
+// at. libaaudio is loaded at run time so older devices still start.
+int AudioOutput::nativeSampleRate() {
+    struct Builder;
+    struct Stream;
+    using CreateBuilder = int32_t (*)(Builder**);
+    using SetPerformanceMode = void (*)(Builder*, int32_t);
+    using OpenStream = int32_t (*)(Builder*, Stream**);
+    using DeleteBuilder = int32_t (*)(Builder*);
+    using GetSampleRate = int32_t (*)(Stream*);
+    using CloseStream = int32_t (*)(Stream*);
+    const int32_t AAUDIO_OK = 0;
+    const int32_t AAUDIO_PERFORMANCE_MODE_LOW_LATENCY = 12;
+
+    void* lib = dlopen("libaaudio.so", RTLD_NOW);
+    if (!lib) {
+        return 0;
+    }
+    auto createBuilder = reinterpret_cast<CreateBuilder>(dlsym(lib, "AAudio_createStreamBuilder"));
+    auto setPerformanceMode = reinterpret_cast<SetPerformanceMode>(
+        dlsym(lib, "AAudioStreamBuilder_setPerformanceMode"));
+    auto openStream = reinterpret_cast<OpenStream>(dlsym(lib, "AAudioStreamBuilder_openStream"));
+    auto deleteBuilder = reinterpret_cast<DeleteBuilder>(dlsym(lib, "AAudioStreamBuilder_delete"));
+    auto getSampleRate = reinterpret_cast<GetSampleRate>(dlsym(lib, "AAudioStream_getSampleRate"));
+    auto closeStream = reinterpret_cast<CloseStream>(dlsym(lib, "AAudioStream_close"));
+
+    int rate = 0;
+    Builder* builder = nullptr;
+    if (createBuilder && setPerformanceMode && openStream && deleteBuilder && getSampleRate && closeStream &&
+        createBuilder(&builder) == AAUDIO_OK) {
+        setPerformanceMode(builder, AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+        Stream* stream = nullptr;
+        if (openStream(builder, &stream) == AAUDIO_OK) {
+            rate = getSampleRate(stream);
+            closeStream(stream);
+        }
+        deleteBuilder(builder);
+    }
+    dlclose(lib);
+    return rate >= MIN_SAMPLE_RATE && rate <= MAX_SAMPLE_RATE ? rate : 0;
 }
 
 bool AudioOutput::init(AudioCallback callback) {
     callback_ = std::move(callback);
 
+    if (impl_->sink == Sink::Wav) {
+        impl_->wav = std::fopen(impl_->wavPath.c_str(), "wb");
+        if (!impl_->wav) {
+            std::fprintf(stderr, "Failed to open WAV file: %s\n", impl_->wavPath.c_str());
+            return false;
+        }
+        impl_->wavFrames = 0;
+        writeWavHeader(impl_->wav, 0, CHANNELS, sampleRate_);
+    }
+    if (impl_->sink != Sink::OpenSL) {
+        return true;
+    }
+
     SLresult result;
 
     // Create engine
@@ -107,7 +266,7 @@ bool AudioOutput::init(AudioCallback callback) {
     SLDataFormat_PCM formatPcm = {
         SL_DATAFORMAT_PCM,
         CHANNELS,
-        SL_SAMPLINGRATE_44_1,
+        static_cast<SLuint32>(sampleRate_) * 1000,   // MilliHertz
         SL_PCMSAMPLEFORMAT_FIXED_16,
         SL_PCMSAMPLEFORMAT_FIXED_16,
         CHANNELS == 2 ? (SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT) : SL_SPEAKER_FRONT_CENTER,
@@ -171,6 +330,19 @@ bool AudioOutput::init(AudioCallback callback) {
 }
 
 bool AudioOutput::start() {
+    if (impl_->sink != Sink::OpenSL) {
+        if (running_.load()) {
+            return false;
+        }
+        running_.store(true);
+        currentBuffer_ = 0;
+        for (int i = 0; i < NUM_BUFFERS; ++i) {
+            fillBuffer(i);
+        }
+        impl_->timer = std::thread(&AudioOutput::timerLoop, this);
+        return true;
+    }
+
     if (!impl_->player) {
         return false;
     }
@@ -197,6 +369,11 @@ bool AudioOutput::start() {
 void AudioOutput::stop() {
     running_.store(false);
 
+    if (impl_->timer.joinable()) {
+        impl_->timer.join();
+    }
+    closeWav();
+
     if (impl_->player) {
         (*impl_->player)->SetPlayState(impl_->player, SL_PLAYSTATE_STOPPED);
     }
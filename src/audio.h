@@ -2,22 +2,52 @@
 #define AUDIO_H
 
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <atomic>
+#include <string>
 
 // Audio callback type: fills buffer with samples, returns number of frames written
 using AudioCallback = std::function<void(int16_t* buffer, int frames)>;
 
+// Observer for each filled buffer, with the steady_clock time it is enqueued
+using EnqueueObserver = std::function<void(const int16_t* buffer, int frames, int64_t enqueueNs)>;
+
 class AudioOutput {
 public:
-    static constexpr int SAMPLE_RATE = 44100;
+    static constexpr int DEFAULT_SAMPLE_RATE = 44100;   // When --rate is not given and
+                                                        // the device rate is unknown
+    static constexpr int MIN_SAMPLE_RATE = 8000;
+    static constexpr int MAX_SAMPLE_RATE = 192000;
     static constexpr int CHANNELS = 2;
     static constexpr int BUFFER_FRAMES = 1024;
     static constexpr int NUM_BUFFERS = 2;
 
+    // Where rendered buffers go. Null and Wav need no audio device: a timer
+    // thread consumes buffers at the real-time rate, like the device would.
+    enum class Sink {
+        OpenSL,     // Android audio output
+        Null,       // Discard
+        Wav         // Append to a WAV file
+    };
+
     AudioOutput();
     ~AudioOutput();
 
+    // Choose the sink (before init)
+    void setSink(Sink sink, const std::string& wavPath = "");
+
+    // Output rate (before init); the synth must render at the same rate
+    void setSampleRate(int sampleRate) { sampleRate_ = sampleRate; }
+    int sampleRate() const { return sampleRate_; }
+
+    // The rate the device mixes at, which skips the system resampler and
+    // allows the low-latency fast track; 0 if it can't be queried
+    static int nativeSampleRate();
+
+    // Watch buffers as they are handed to the sink (before start)
+    void setEnqueueObserver(EnqueueObserver observer) { enqueueObserver_ = std::move(observer); }
+
     // Initialize OpenSL ES audio output
     bool init(AudioCallback callback);
 
@@ -35,10 +65,18 @@ private:
     struct Impl;
     Impl* impl_ = nullptr;
     AudioCallback callback_;
+    EnqueueObserver enqueueObserver_;
     std::atomic<bool> running_{false};
     int currentBuffer_ = 0;
+    int sampleRate_ = DEFAULT_SAMPLE_RATE;
 
     void fillBuffer(int bufferIndex);
+    void timerLoop();
+    void closeWav();
 };
 
+// Write a 16-bit PCM WAV header for frames of audio at the current position.
+// Write it once before the data and again at offset 0 with the final count.
+void writeWavHeader(FILE* f, uint32_t frames, int channels, int sampleRate);
+
 #endif // AUDIO_H
@@ -0,0 +1,405 @@
+#include "bench.h"
+#include "audio.h"
+#include "synth.h"
+#include "midi_file.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+namespace {
+
+using BenchClock = std::chrono::steady_clock;
+
+constexpr int BUFFER_FRAMES = AudioOutput::BUFFER_FRAMES;
+constexpr int KEYS_PER_CHANNEL = 64;        // Keys 36-99 per channel
+constexpr double RETRIGGER_SECONDS = 1.0;   // Restart decaying notes this often
+constexpr int STORM_NOTES_PER_BUFFER = 128;
+constexpr int PROBE_BUFFERS = 16;
+constexpr int MAX_PROBE_VOICES = 16384;
+constexpr double MAX_FILE_SECONDS = 600.0;
+
+struct Result {
+    std::string name;
+    std::string preset;
+    double voices = 0.0;       // Average active voices
+    long long frames = 0;
+    double seconds = 0.0;      // Wall time spent rendering
+    long long events = 0;      // MIDI events applied (0 if not relevant)
+};
+
+double secondsSince(BenchClock::time_point start) {
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Channel for the i-th voice: melodic voices skip the drum channel of each block
+int voiceChannel(int voice, bool drums) {
+    int block = voice / KEYS_PER_CHANNEL;
+    if (drums) {
+        return (block % 16) * 16 + 9;
+    }
+    int channel = block % 15;
+    return channel >= 9 ? channel + 1 : channel;
+}
+
+int voiceKey(int voice) {
+    return 36 + voice % KEYS_PER_CHANNEL;
+}
+
+// Release everything and render silently until the voices have died away
+void settle(Synthesizer& synth) {
+    const int sampleRate = synth.getSampleRate();
+    std::vector<int16_t> buffer(BUFFER_FRAMES * 2);
+    synth.allNotesOff();
+    for (int i = 0; i < sampleRate * 10 / BUFFER_FRAMES && synth.getActiveVoiceCount() > 0; ++i) {
+        synth.render(buffer.data(), BUFFER_FRAMES);
+    }
+}
+
+void startVoices(Synthesizer& synth, const Synthesizer::PresetInfo& preset, int voices) {
+    bool drums = preset.bank == 128;
+    std::vector<MidiEvent> events;
+    for (int i = 0; i < voices; ++i) {
+        MidiEvent ev;
+        if (i % KEYS_PER_CHANNEL == 0) {
+            ev.type = MIDI_PROGRAM_CHANGE;
+            ev.channel = voiceChannel(i, drums);
+            ev.param1 = preset.program;
+            events.push_back(ev);
+        }
+        ev.type = MIDI_NOTE_ON;
+        ev.channel = voiceChannel(i, drums);
+        ev.param1 = voiceKey(i);
+        ev.param2 = 100;
+        events.push_back(ev);
+    }
+    synth.applyEvents(events.data(), static_cast<int>(events.size()));
+}
+
+// N notes held on one preset, restarted every second so decaying samples
+// keep the voice count up
+Result runSustained(Synthesizer& synth, const std::string& name, int presetIndex,
+                    int voices, double seconds) {
+    Result result;
+    result.name = name;
+    result.preset = synth.getPresetName(presetIndex);
+    Synthesizer::PresetInfo preset = synth.getPresetInfo(presetIndex);
+
+    settle(synth);
+    const int sampleRate = synth.getSampleRate();
+    std::vector<int16_t> buffer(BUFFER_FRAMES * 2);
+    int buffers = static_cast<int>(seconds * sampleRate / BUFFER_FRAMES);
+    int retrigger = static_cast<int>(RETRIGGER_SECONDS * sampleRate / BUFFER_FRAMES);
+    long long voiceSum = 0;
+
+    BenchClock::time_point start = BenchClock::now();
+    for (int b = 0; b < buffers; ++b) {
+        if (b % retrigger == 0) {
+            if (b > 0) {
+                synth.allNotesOff();
+            }
+            startVoices(synth, preset, voices);
+            result.events += voices;
+        }
+        synth.render(buffer.data(), BUFFER_FRAMES);
+        voiceSum += synth.getActiveVoiceCount();
+    }
+    result.seconds = secondsSince(start);
+    result.frames = static_cast<long long>(buffers) * BUFFER_FRAMES;
+    result.voices = buffers > 0 ? static_cast<double>(voiceSum) / buffers : 0.0;
+    return result;
+}
+
+// Note-on/off churn: every buffer releases the previous chord and starts a new one
+Result runStorm(Synthesizer& synth, int presetIndex, double seconds) {
+    Result result;
+    result.name = "note-storm";
+    result.preset = synth.getPresetName(presetIndex);
+    Synthesizer::PresetInfo preset = synth.getPresetInfo(presetIndex);
+
+    settle(synth);
+    for (int ch = 0; ch < 16; ++ch) {
+        if (ch != 9) {
+            synth.programChange(ch, preset.program);
+        }
+    }
+
+    const int sampleRate = synth.getSampleRate();
+    std::vector<int16_t> buffer(BUFFER_FRAMES * 2);
+    std::vector<MidiEvent> events;
+    std::vector<MidiEvent> held;
+    int buffers = static_cast<int>(seconds * sampleRate / BUFFER_FRAMES);
+    long long voiceSum = 0;
+
+    BenchClock::time_point start = BenchClock::now();
+    for (int b = 0; b < buffers; ++b) {
+        events.clear();
+        for (MidiEvent ev : held) {
+            ev.type = MIDI_NOTE_OFF;
+            events.push_back(ev);
+        }
+        held.clear();
+        for (int i = 0; i < STORM_NOTES_PER_BUFFER; ++i) {
+            MidiEvent ev;
+            ev.type = MIDI_NOTE_ON;
+            ev.channel = voiceChannel(i * 4, false) % 16;
+            ev.param1 = 21 + (i * 37 + b * 11) % 88;
+            ev.param2 = 40 + (i * 13 + b) % 80;
+            events.push_back(ev);
+            held.push_back(ev);
+        }
+        synth.applyEvents(events.data(), static_cast<int>(events.size()));
+        result.events += events.size();
+        synth.render(buffer.data(), BUFFER_FRAMES);
+        voiceSum += synth.getActiveVoiceCount();
+    }
+    result.seconds = secondsSince(start);
+    result.frames = static_cast<long long>(buffers) * BUFFER_FRAMES;
+    result.voices = buffers > 0 ? static_cast<double>(voiceSum) / buffers : 0.0;
+    return result;
+}
+
+// Play a MIDI file through MidiPlayer as fast as possible
+bool runFile(Synthesizer& synth, const std::string& path, Result& result) {
+    result.name = "midi-file";
+    result.preset = path;
+
+    settle(synth);
+    // General MIDI reset: files that never send a program change still sound
+    for (int ch = 0; ch < 16; ++ch) {
+        synth.programChange(ch, 0);
+    }
+
+    MidiPlayer player(synth);
+    if (!player.load(path)) {
+        return false;
+    }
+    player.play();
+
+    const int sampleRate = synth.getSampleRate();
+    std::vector<int16_t> buffer(BUFFER_FRAMES * 2);
+    int maxBuffers = static_cast<int>(MAX_FILE_SECONDS * sampleRate / BUFFER_FRAMES);
+    long long voiceSum = 0;
+    int buffers = 0;
+
+    BenchClock::time_point start = BenchClock::now();
+    while (!player.isFinished() && buffers < maxBuffers) {
+        player.process(BUFFER_FRAMES);
+        synth.render(buffer.data(), BUFFER_FRAMES);
+        voiceSum += synth.getActiveVoiceCount();
+        ++buffers;
+    }
+    result.seconds = secondsSince(start);
+    result.frames = static_cast<long long>(buffers) * BUFFER_FRAMES;
+    result.voices = buffers > 0 ? static_cast<double>(voiceSum) / buffers : 0.0;
+    return true;
+}
+
+// Does rendering this many voices fit in the buffer period on average?
+bool probeVoices(Synthesizer& synth, const Synthesizer::PresetInfo& preset, int voices,
+                 double& voicesSeen) {
+    settle(synth);
+    startVoices(synth, preset, voices);
+
+    std::vector<int16_t> buffer(BUFFER_FRAMES * 2);
+    synth.render(buffer.data(), BUFFER_FRAMES);  // Warm-up
+    voicesSeen = synth.getActiveVoiceCount();
+
+    BenchClock::time_point start = BenchClock::now();
+    for (int i = 0; i < PROBE_BUFFERS; ++i) {
+        synth.render(buffer.data(), BUFFER_FRAMES);
+    }
+    double perBuffer = secondsSince(start) / PROBE_BUFFERS;
+    return perBuffer < static_cast<double>(BUFFER_FRAMES) / synth.getSampleRate();
+}
+
+// Largest voice count whose render time stays inside the buffer deadline
+int findMaxVoices(Synthesizer& synth, int presetIndex) {
+    Synthesizer::PresetInfo preset = synth.getPresetInfo(presetIndex);
+    double seen = 0.0;
+    int pass = 0;
+    int fail = 0;
+    int maxSeen = 0;
+
+    for (int n = 32; n <= MAX_PROBE_VOICES; n *= 2) {
+        if (probeVoices(synth, preset, n, seen)) {
+            pass = n;
+            maxSeen = static_cast<int>(seen);
+        } else {
+            fail = n;
+            break;
+        }
+    }
+
+    if (pass > 0 && fail > 0) {
+        while (fail - pass > fail / 32) {
+            int mid = (pass + fail) / 2;
+            if (probeVoices(synth, preset, mid, seen)) {
+                pass = mid;
+                maxSeen = static_cast<int>(seen);
+            } else {
+                fail = mid;
+            }
+        }
+    }
+    settle(synth);
+    return maxSeen;
+}
+
+// First bank 0 preset with a program in [first, last], or -1
+int findPreset(Synthesizer& synth, int bank, int first, int last) {
+    int count = synth.getPresetCount();
+    for (int program = first; program <= last; ++program) {
+        for (int i = 0; i < count; ++i) {
+            Synthesizer::PresetInfo info = synth.getPresetInfo(i);
+            if (info.bank == bank && info.program == program) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+// Bank 0 or drum preset with the largest share of filtered regions, or -1
+int findFilteredPreset(Synthesizer& synth) {
+    int best = -1;
+    double bestShare = 0.0;
+    int count = synth.getPresetCount();
+    for (int i = 0; i < count; ++i) {
+        Synthesizer::PresetInfo info = synth.getPresetInfo(i);
+        if ((info.bank != 0 && info.bank != 128) || info.regions == 0) {
+            continue;
+        }
+        double share = static_cast<double>(info.filteredRegions) / info.regions;
+        if (share > bestShare) {
+            best = i;
+            bestShare = share;
+        }
+    }
+    return best;
+}
+
+std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+long peakRssKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;  // Kilobytes on Linux and Android
+}
+
+} // namespace
+
+int runBench(const BenchOptions& options) {
+    Synthesizer synth;
+    const int sampleRate = options.sampleRate;
+
+    BenchClock::time_point loadStart = BenchClock::now();
+    if (!synth.loadSoundFont(options.sf2Path)) {
+        return 1;
+    }
+    double loadMs = secondsSince(loadStart) * 1000.0;
+    synth.setOutput(sampleRate, AudioOutput::CHANNELS);
+
+    if (!options.json) {
+        std::printf("Soundfont: %s (loaded in %.1f ms)\n", options.sf2Path.c_str(), loadMs);
+        std::printf("Rendering %d-frame buffers at %d Hz\n\n", BUFFER_FRAMES, sampleRate);
+    }
+
+    // Sustained voices per preset type (General MIDI program ranges)
+    struct Category {
+        const char* name;
+        int bank, first, last;
+    };
+    const Category categories[] = {
+        {"sustain-piano", 0, 0, 7},
+        {"sustain-organ", 0, 16, 23},
+        {"sustain-strings", 0, 40, 55},
+        {"sustain-pad", 0, 88, 95},
+        {"sustain-drums", 128, 0, 127},
+    };
+
+    std::vector<Result> results;
+    int reference = -1;
+    for (const Category& category : categories) {
+        int index = findPreset(synth, category.bank, category.first, category.last);
+        if (index < 0) {
+            continue;
+        }
+        if (reference < 0) {
+            reference = index;
+        }
+        results.push_back(runSustained(synth, category.name, index, options.voices, options.seconds));
+    }
+
+    int filtered = findFilteredPreset(synth);
+    if (filtered >= 0) {
+        results.push_back(runSustained(synth, "sustain-filtered", filtered, options.voices, options.seconds));
+    }
+
+    if (reference < 0 && synth.getPresetCount() > 0) {
+        reference = 0;
+    }
+    int maxVoices = 0;
+    if (reference >= 0) {
+        results.push_back(runStorm(synth, reference, options.seconds));
+        maxVoices = findMaxVoices(synth, reference);
+    }
+
+    if (!options.midiPath.empty()) {
+        Result result;
+        if (!runFile(synth, options.midiPath, result)) {
+            return 1;
+        }
+        results.push_back(result);
+    }
+
+    long rssKb = peakRssKb();
+    double deadlineMs = 1000.0 * BUFFER_FRAMES / sampleRate;
+
+    if (options.json) {
+        std::printf("{\"version\":%s,\"soundfont\":%s,\"sample_rate\":%d,\"buffer_frames\":%d,"
+                    "\"load_ms\":%.3f,\"max_voices\":%d,\"max_voices_preset\":%s,\"peak_rss_kb\":%ld,"
+                    "\"scenarios\":[",
+                    jsonString(options.version).c_str(), jsonString(options.sf2Path).c_str(),
+                    sampleRate, BUFFER_FRAMES, loadMs, maxVoices,
+                    jsonString(reference >= 0 ? synth.getPresetName(reference) : "").c_str(), rssKb);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            double fps = r.seconds > 0 ? r.frames / r.seconds : 0.0;
+            std::printf("%s{\"name\":%s,\"preset\":%s,\"avg_voices\":%.1f,\"frames\":%lld,"
+                        "\"seconds\":%.6f,\"frames_per_sec\":%.0f,\"realtime_factor\":%.2f,\"events\":%lld}",
+                        i ? "," : "", jsonString(r.name).c_str(), jsonString(r.preset).c_str(),
+                        r.voices, r.frames, r.seconds, fps, fps / sampleRate, r.events);
+        }
+        std::printf("]}\n");
+        return 0;
+    }
+
+    std::printf("%-18s %-22s %8s %10s %12s\n", "scenario", "preset", "voices", "realtime", "frames/s");
+    for (const Result& r : results) {
+        double fps = r.seconds > 0 ? r.frames / r.seconds : 0.0;
+        std::printf("%-18s %-22.22s %8.1f %9.1fx %12.0f\n",
+                    r.name.c_str(), r.preset.c_str(), r.voices, fps / sampleRate, fps);
+    }
+    std::printf("\nMax voices within the %.1f ms buffer deadline: %d\n", deadlineMs, maxVoices);
+    std::printf("Peak RSS: %ld KB\n", rssKb);
+    return 0;
+}
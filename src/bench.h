@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+// Offline synthesis benchmark: drives Synthesizer::render() directly, with
+// no audio device, using fixed and repeatable workloads.
+struct BenchOptions {
+    std::string sf2Path;
+    std::string midiPath;    // Optional dense reference file
+    int voices = 64;         // Voices per sustained-preset scenario
+    double seconds = 10.0;   // Audio rendered per scenario
+    int sampleRate = 44100;  // Output rate rendered at
+    bool json = false;       // Machine-readable output
+    std::string version;     // Build version recorded in the JSON report
+};
+
+// Run every scenario and print the report (returns the process exit code)
+int runBench(const BenchOptions& options);
+
+#endif // BENCH_H
@@ -1,8 +1,15 @@
 #include "input.h"
 #include "synth.h"
+#include "midi_file.h"
+#include "midi_parser.h"
+#include "trace.h"
+#include "thread_policy.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
-#include <sstream>
+#include <cstdlib>
 #include <poll.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -10,6 +17,70 @@
 #include <fcntl.h>
 #include <errno.h>
 
+// Connected socket client with its own partial-message state
+struct InputHandler::Client {
+    int fd = -1;
+    std::string line;                                    // Text: lines not run yet
+    bool eof = false;                                    // Closed; kept while parked
+    MidiParser parser;                                   // Raw MIDI: running status
+    uint8_t record[InputHandler::BINARY_RECORD_SIZE];    // Binary: incomplete record
+    int recordBytes = 0;
+    CommandBatch commands;                               // Text: pending batch
+};
+
+namespace {
+
+// Allocation-free cursor over the words of one command
+struct Tokenizer {
+    const char* pos;
+    const char* end;
+
+    // Next whitespace-delimited word; false when the command is exhausted
+    bool word(const char*& start, size_t& length) {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) ++pos;
+        start = pos;
+        while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\r') ++pos;
+        length = pos - start;
+        return length > 0;
+    }
+
+    // Next word parsed as a number; the whole word must be numeric
+    bool number(double& value) {
+        const char* start;
+        size_t length;
+        char text[32];
+        if (!word(start, length) || length >= sizeof(text)) {
+            return false;
+        }
+        std::memcpy(text, start, length);
+        text[length] = '\0';
+        char* parsed;
+        value = std::strtod(text, &parsed);
+        return parsed == text + length;
+    }
+
+    bool integer(int& value, int min, int max) {
+        double v;
+        // Range first: casting NaN or an out-of-range double is undefined
+        if (!number(v) || !std::isfinite(v) || v < min || v > max || v != static_cast<int>(v)) {
+            return false;
+        }
+        value = static_cast<int>(v);
+        return true;
+    }
+};
+
+int64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool wordIs(const char* word, size_t length, const char* name) {
+    return std::strlen(name) == length && std::memcmp(word, name, length) == 0;
+}
+
+} // namespace
+
 InputHandler::InputHandler(Synthesizer& synth)
     : synth_(synth) {
 }
@@ -21,6 +92,12 @@ InputHandler::~InputHandler() {
 void InputHandler::stop() {
     running_.store(false);
 
+    // Wake the input thread out of poll()
+    if (wakeFds_[1] >= 0) {
+        char c = 0;
+        (void)!write(wakeFds_[1], &c, 1);
+    }
+
     if (inputThread_.joinable()) {
         inputThread_.join();
     }
@@ -38,6 +115,25 @@ void InputHandler::cleanup() {
         unlink(socketPath_.c_str());
         socketPath_.clear();
     }
+
+    for (int& fd : wakeFds_) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+bool InputHandler::openWakePipe() {
+    if (pipe(wakeFds_) < 0) {
+        std::fprintf(stderr, "Failed to create wake pipe: %s\n", strerror(errno));
+        return false;
+    }
+    for (int fd : wakeFds_) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return true;
 }
 
 void InputHandler::startStdin(QuitCallback onQuit) {
@@ -45,12 +141,17 @@ void InputHandler::startStdin(QuitCallback onQuit) {
         return;
     }
 
+    if (!openWakePipe()) {
+        return;
+    }
+
+    source_ = RuntimeStats::Source::Stdin;
     quitCallback_ = std::move(onQuit);
     running_.store(true);
     inputThread_ = std::thread(&InputHandler::stdinLoop, this);
 }
 
-bool InputHandler::startSocket(const std::string& path, QuitCallback onQuit) {
+bool InputHandler::startSocket(const std::string& path, QuitCallback onQuit, SocketProtocol protocol) {
     if (running_.load()) {
         return false;
     }
@@ -78,15 +179,26 @@ bool InputHandler::startSocket(const std::string& path, QuitCallback onQuit) {
         return false;
     }
 
+    // Accept non-blocking so a burst of connects never stalls the loop
+    fcntl(socketFd_, F_SETFL, fcntl(socketFd_, F_GETFL, 0) | O_NONBLOCK);
+
     // Listen for connections
-    if (listen(socketFd_, 5) < 0) {
+    if (listen(socketFd_, SOMAXCONN) < 0) {
         std::fprintf(stderr, "Failed to listen on socket: %s\n", strerror(errno));
         close(socketFd_);
         socketFd_ = -1;
         return false;
     }
 
+    if (!openWakePipe()) {
+        close(socketFd_);
+        socketFd_ = -1;
+        return false;
+    }
+
     socketPath_ = path;
+    protocol_ = protocol;
+    source_ = RuntimeStats::Source::Socket;
     quitCallback_ = std::move(onQuit);
     running_.store(true);
     inputThread_ = std::thread(&InputHandler::socketLoop, this);
@@ -97,31 +209,41 @@ bool InputHandler::startSocket(const std::string& path, QuitCallback onQuit) {
 
 void InputHandler::stdinLoop() {
     char buffer[1024];
+    CommandBatch commands;
 
     // Set stdin to non-blocking for poll
     int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
     fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    Trace::registerThread("stdin-input");
+    ThreadPolicy::apply(ThreadPolicy::Role::Input, "stdin-input");
 
     while (running_.load()) {
-        struct pollfd pfd;
-        pfd.fd = STDIN_FILENO;
-        pfd.events = POLLIN;
+        struct pollfd pfds[2];
+        pfds[0].fd = STDIN_FILENO;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = wakeFds_[0];
+        pfds[1].events = POLLIN;
 
-        int ret = poll(&pfd, 1, 100);  // 100ms timeout
+        int ret = poll(pfds, 2, -1);
         if (ret < 0) {
             if (errno == EINTR) continue;
             break;
         }
 
-        if (ret > 0 && (pfd.revents & POLLIN)) {
+        if (pfds[1].revents) {
+            break;  // stop() requested
+        }
+
+        if (pfds[0].revents & (POLLIN | POLLHUP)) {
             if (std::fgets(buffer, sizeof(buffer), stdin)) {
+                TraceSpan span("stdin.command");
                 // Remove trailing newline
                 size_t len = std::strlen(buffer);
                 if (len > 0 && buffer[len - 1] == '\n') {
                     buffer[len - 1] = '\0';
                 }
 
-                if (!processCommand(buffer)) {
+                if (!processCommand(buffer, std::strlen(buffer), commands)) {
                     break;
                 }
             } else if (std::feof(stdin)) {
@@ -130,6 +252,8 @@ void InputHandler::stdinLoop() {
         }
     }
 
+    endBatch(commands);
+
     // Restore blocking mode
     fcntl(STDIN_FILENO, F_SETFL, flags);
 
@@ -140,118 +264,389 @@ void InputHandler::stdinLoop() {
 }
 
 void InputHandler::socketLoop() {
+    std::vector<Client> clients;
+    std::vector<struct pollfd> pfds;
+    std::vector<MidiEvent> batch;
+    batch.reserve(CLIENT_READ_SIZE);
+    Trace::registerThread("socket-input");
+    ThreadPolicy::apply(ThreadPolicy::Role::Input, "socket-input");
+
     while (running_.load()) {
-        struct pollfd pfd;
-        pfd.fd = socketFd_;
-        pfd.events = POLLIN;
+        // Slot 0 is the wake pipe, slot 1 the listening socket, then clients.
+        // A client parked by 'sleep' isn't read; the earliest one to resume
+        // bounds the wait.
+        pfds.resize(2 + clients.size());
+        pfds[0] = {wakeFds_[0], POLLIN, 0};
+        pfds[1] = {socketFd_, POLLIN, 0};
+        int64_t nowNs = steadyNs();
+        int timeoutMs = -1;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            int64_t resumeNs = clients[i].commands.resumeNs;
+            pfds[2 + i] = {resumeNs ? -1 : clients[i].fd, POLLIN, 0};
+            if (resumeNs) {
+                int ms = static_cast<int>(std::max<int64_t>(0, (resumeNs - nowNs + 999999) / 1000000));
+                timeoutMs = timeoutMs < 0 ? ms : std::min(timeoutMs, ms);
+            }
+        }
 
-        int ret = poll(&pfd, 1, 100);
+        int ret = poll(pfds.data(), pfds.size(), timeoutMs);
         if (ret < 0) {
             if (errno == EINTR) continue;
             break;
         }
 
-        if (ret > 0 && (pfd.revents & POLLIN)) {
-            int clientFd = accept(socketFd_, nullptr, nullptr);
-            if (clientFd < 0) {
-                continue;
+        if (pfds[0].revents) {
+            break;  // stop() requested
+        }
+
+        // One read per ready client per iteration, all merged into one batch
+        TraceSpan span("socket.receive");
+        batch.clear();
+        size_t kept = 0;
+        nowNs = steadyNs();
+        for (size_t i = 0; i < clients.size(); ++i) {
+            Client& client = clients[i];
+            bool open = true;
+            if (client.commands.resumeNs) {
+                if (client.commands.resumeNs <= nowNs) {
+                    client.commands.resumeNs = 0;
+                    open = runClientLines(client);
+                }
+            } else if (pfds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                open = readClient(client, batch);
+            }
+            // A closed client goes once its last lines have run
+            if (client.eof && !client.commands.resumeNs) {
+                open = false;
             }
 
-            std::printf("Client connected\n");
-
-            // Handle client
-            char buffer[1024];
-            FILE* clientFile = fdopen(clientFd, "r");
-            if (clientFile) {
-                while (running_.load() && std::fgets(buffer, sizeof(buffer), clientFile)) {
-                    size_t len = std::strlen(buffer);
-                    if (len > 0 && buffer[len - 1] == '\n') {
-                        buffer[len - 1] = '\0';
-                    }
-
-                    if (!processCommand(buffer)) {
-                        break;
-                    }
+            if (open) {
+                if (kept != i) {
+                    clients[kept] = std::move(clients[i]);
                 }
-                std::fclose(clientFile);
+                ++kept;
             } else {
-                close(clientFd);
+                endBatch(clients[i].commands);
+                close(clients[i].fd);
+                std::printf("Client disconnected\n");
             }
+        }
+        clients.resize(kept);
 
-            std::printf("Client disconnected\n");
+        if (!batch.empty()) {
+            Trace::instant("socket.events", static_cast<int>(batch.size()));
+            synth_.applyEvents(batch.data(), static_cast<int>(batch.size()));
+            synth_.stats().countEvents(source_, static_cast<int>(batch.size()));
+        }
+        span.setCount(static_cast<int>(batch.size()));
+        span.end();
+
+        // Accept everything pending on the listening socket
+        if (pfds[1].revents & POLLIN) {
+            for (;;) {
+                int clientFd = accept(socketFd_, nullptr, nullptr);
+                if (clientFd < 0) {
+                    break;
+                }
+                fcntl(clientFd, F_SETFL, fcntl(clientFd, F_GETFL, 0) | O_NONBLOCK);
+                fcntl(clientFd, F_SETFD, FD_CLOEXEC);
+
+                Client client;
+                client.fd = clientFd;
+                client.commands.replyFd = clientFd;
+                client.commands.parkOnSleep = true;
+                clients.push_back(std::move(client));
+                std::printf("Client connected\n");
+            }
         }
     }
 
+    for (Client& client : clients) {
+        close(client.fd);
+    }
+
     running_.store(false);
     if (quitCallback_) {
         quitCallback_();
     }
 }
 
+bool InputHandler::readClient(Client& client, std::vector<MidiEvent>& batch) {
+    uint8_t buffer[CLIENT_READ_SIZE];
+    ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (n == 0) {
+        // Client closed the connection; a last line sent without '\n' still
+        // runs, and a parked client stays until its lines are done
+        client.eof = true;
+        if (protocol_ == SocketProtocol::Text && !client.line.empty()) {
+            client.line += '\n';
+            return runClientLines(client);
+        }
+        return false;
+    }
+
+    switch (protocol_) {
+        case SocketProtocol::Text: {
+            client.line.append(reinterpret_cast<const char*>(buffer), n);
+            if (!runClientLines(client)) {
+                return false;  // quit closes this client
+            }
+            if (client.line.size() > MAX_LINE) {
+                std::fprintf(stderr, "Client line longer than %zu bytes, disconnecting\n", MAX_LINE);
+                reply(client.commands, "error line too long");
+                return false;
+            }
+            break;
+        }
+
+        case SocketProtocol::RawMidi: {
+            size_t offset = batch.size();
+            batch.resize(offset + n);
+            int count = client.parser.decode(buffer, n, batch.data() + offset);
+            batch.resize(offset + count);
+            break;
+        }
+
+        case SocketProtocol::Binary:
+            for (ssize_t i = 0; i < n; ++i) {
+                client.record[client.recordBytes++] = buffer[i];
+                if (client.recordBytes < BINARY_RECORD_SIZE) {
+                    continue;
+                }
+                client.recordBytes = 0;
+
+                uint8_t status = client.record[0];
+                if (status < 0x80 || status >= 0xF0) {
+                    continue;  // Not a channel message
+                }
+                MidiEvent ev;
+                ev.type = status & 0xF0;
+                ev.channel = status & 0x0F;
+                ev.param1 = client.record[1] & 0x7F;
+                ev.param2 = client.record[2] & 0x7F;
+                batch.push_back(ev);
+            }
+            break;
+    }
+
+    return true;
+}
+
+bool InputHandler::runClientLines(Client& client) {
+    // Run every complete line until one parks the client, keep the rest
+    size_t start = 0, newline;
+    while (!client.commands.resumeNs && (newline = client.line.find('\n', start)) != std::string::npos) {
+        const char* command = client.line.data() + start;
+        const char* rest = nullptr;
+        if (!processCommand(command, newline - start, client.commands, &rest)) {
+            return false;
+        }
+        start = client.commands.resumeNs ? rest - client.line.data() : newline + 1;
+    }
+    client.line.erase(0, start);
+    return true;
+}
+
 bool InputHandler::processCommand(const std::string& line) {
-    if (line.empty()) {
+    CommandBatch batch;
+    return processCommand(line.data(), line.size(), batch);
+}
+
+bool InputHandler::processCommand(const char* line, size_t length, CommandBatch& batch,
+                                  const char** rest) {
+    // Run each ';'-separated command, then apply the line's MIDI events at once
+    const char* end = line + length;
+    const char* start = line;
+    bool keepGoing = true;
+    for (;;) {
+        const char* sep = static_cast<const char*>(std::memchr(start, ';', end - start));
+        keepGoing = runCommand(start, sep ? sep : end, batch);
+        if (batch.open && batch.events.size() >= MAX_BATCH_EVENTS) {
+            std::fprintf(stderr, "begin: more than %zu events, applying them before commit\n",
+                         MAX_BATCH_EVENTS);
+            flushBatch(batch);
+        }
+        if (batch.resumeNs) {
+            // Parked: the remaining commands run when it resumes
+            if (rest) {
+                *rest = sep ? sep + 1 : end;
+            }
+            break;
+        }
+        if (!keepGoing || !sep) {
+            break;
+        }
+        start = sep + 1;
+    }
+
+    if (!batch.open || !keepGoing) {
+        flushBatch(batch);
+    }
+    return keepGoing;
+}
+
+void InputHandler::flushBatch(CommandBatch& batch) {
+    if (!batch.events.empty()) {
+        Trace::instant(source_ == RuntimeStats::Source::Stdin ? "stdin.events" : "socket.events",
+                       static_cast<int>(batch.events.size()));
+        synth_.applyEvents(batch.events.data(), static_cast<int>(batch.events.size()));
+        synth_.stats().countEvents(source_, static_cast<int>(batch.events.size()));
+        batch.events.clear();
+    }
+}
+
+void InputHandler::endBatch(CommandBatch& batch) {
+    // A source that goes away inside begin ... commit still gets its events
+    if (batch.open && !batch.events.empty()) {
+        std::fprintf(stderr, "Input ended inside begin ... commit, applying %zu events\n",
+                     batch.events.size());
+    }
+    batch.open = false;
+    flushBatch(batch);
+}
+
+void InputHandler::reply(const CommandBatch& batch, const std::string& text) {
+    if (batch.replyFd < 0) {
+        std::printf("%s\n", text.c_str());
+        std::fflush(stdout);
+        return;
+    }
+    // Replies are one short line; a client that never reads loses them
+    std::string line = text + "\n";
+    (void)!write(batch.replyFd, line.data(), line.size());
+}
+
+bool InputHandler::runCommand(const char* begin, const char* end, CommandBatch& batch) {
+    Tokenizer tok{begin, end};
+    const char* cmd;
+    size_t len;
+    if (!tok.word(cmd, len)) {
         return true;
     }
 
-    std::istringstream iss(line);
-    std::string cmd;
-    iss >> cmd;
+    MidiEvent ev;
+    ev.time = 0.0;
 
-    if (cmd == "quit" || cmd == "exit") {
+    if (wordIs(cmd, len, "quit") || wordIs(cmd, len, "exit")) {
         return false;
     }
-    else if (cmd == "noteon") {
+    else if (wordIs(cmd, len, "begin")) {
+        if (batch.open) {
+            std::fprintf(stderr, "begin: batch already open\n");
+        }
+        batch.open = true;
+        return true;
+    }
+    else if (wordIs(cmd, len, "commit")) {
+        if (!batch.open) {
+            std::fprintf(stderr, "commit: no open batch\n");
+        }
+        batch.open = false;
+        flushBatch(batch);
+        return true;
+    }
+    else if (wordIs(cmd, len, "noteon")) {
         int channel, note, velocity;
-        if (iss >> channel >> note >> velocity) {
-            synth_.noteOn(channel, note, velocity / 127.0f);
+        if (tok.integer(channel, 0, 255) && tok.integer(note, 0, 127) && tok.integer(velocity, 0, 127)) {
+            ev.type = MIDI_NOTE_ON;
+            ev.channel = channel;
+            ev.param1 = note;
+            ev.param2 = velocity;
+            batch.events.push_back(ev);
         } else {
             std::fprintf(stderr, "Usage: noteon <channel> <note> <velocity>\n");
         }
+        return true;
     }
-    else if (cmd == "noteoff") {
+    else if (wordIs(cmd, len, "noteoff")) {
         int channel, note;
-        if (iss >> channel >> note) {
-            synth_.noteOff(channel, note);
+        if (tok.integer(channel, 0, 255) && tok.integer(note, 0, 127)) {
+            ev.type = MIDI_NOTE_OFF;
+            ev.channel = channel;
+            ev.param1 = note;
+            ev.param2 = 0;
+            batch.events.push_back(ev);
         } else {
             std::fprintf(stderr, "Usage: noteoff <channel> <note>\n");
         }
+        return true;
     }
-    else if (cmd == "cc") {
+    else if (wordIs(cmd, len, "cc")) {
         int channel, controller, value;
-        if (iss >> channel >> controller >> value) {
-            synth_.controlChange(channel, controller, value);
+        if (tok.integer(channel, 0, 255) && tok.integer(controller, 0, 127) && tok.integer(value, 0, 127)) {
+            ev.type = MIDI_CONTROL_CHANGE;
+            ev.channel = channel;
+            ev.param1 = controller;
+            ev.param2 = value;
+            batch.events.push_back(ev);
         } else {
             std::fprintf(stderr, "Usage: cc <channel> <controller> <value>\n");
         }
+        return true;
     }
-    else if (cmd == "pc") {
+    else if (wordIs(cmd, len, "pc")) {
         int channel, program;
-        if (iss >> channel >> program) {
-            synth_.programChange(channel, program);
+        if (tok.integer(channel, 0, 255) && tok.integer(program, 0, 127)) {
+            ev.type = MIDI_PROGRAM_CHANGE;
+            ev.channel = channel;
+            ev.param1 = program;
+            ev.param2 = 0;
+            batch.events.push_back(ev);
         } else {
             std::fprintf(stderr, "Usage: pc <channel> <program>\n");
         }
+        return true;
     }
-    else if (cmd == "pitch") {
+    else if (wordIs(cmd, len, "pitch")) {
         int channel, value;
-        if (iss >> channel >> value) {
-            synth_.pitchBend(channel, value);
+        if (tok.integer(channel, 0, 255) && tok.integer(value, 0, 16383)) {
+            ev.type = MIDI_PITCH_BEND;
+            ev.channel = channel;
+            ev.param1 = value & 0x7F;
+            ev.param2 = value >> 7;
+            batch.events.push_back(ev);
         } else {
             std::fprintf(stderr, "Usage: pitch <channel> <value>\n");
         }
+        return true;
     }
-    else if (cmd == "panic") {
+
+    // Remaining commands act immediately, after the MIDI queued before them
+    flushBatch(batch);
+
+    if (wordIs(cmd, len, "tempo")) {
+        double speed;
+        if (!player_) {
+            std::fprintf(stderr, "tempo: no MIDI file playing\n");
+        } else if (tok.number(speed) && speed > 0) {
+            player_->setSpeed(speed);
+        } else {
+            std::fprintf(stderr, "Usage: tempo <speed>  (1.0 = original)\n");
+        }
+    }
+    else if (wordIs(cmd, len, "panic")) {
         synth_.allNotesOff();
     }
-    else if (cmd == "sleep") {
-        // Sleep command for scripting (in seconds)
+    else if (wordIs(cmd, len, "stats")) {
+        reply(batch, synth_.getStatsJson());
+    }
+    else if (wordIs(cmd, len, "sleep")) {
+        // Sleep command for scripting (in seconds). Socket clients share one
+        // thread, so only the client that asked waits.
         double seconds;
-        if (iss >> seconds) {
-            usleep(static_cast<useconds_t>(seconds * 1000000));
+        if (tok.number(seconds) && seconds > 0) {
+            if (batch.parkOnSleep) {
+                batch.resumeNs = steadyNs() + static_cast<int64_t>(seconds * 1e9);
+            } else {
+                usleep(static_cast<useconds_t>(seconds * 1000000));
+            }
         }
     }
     else {
-        std::fprintf(stderr, "Unknown command: %s\n", cmd.c_str());
+        std::fprintf(stderr, "Unknown command: %.*s\n", static_cast<int>(len), cmd);
     }
 
     return true;
@@ -1,18 +1,53 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include "midi_event.h"
+#include "runtime_stats.h"
 #include <string>
+#include <vector>
 #include <atomic>
+#include <cstdint>
 #include <thread>
 #include <functional>
 
 class Synthesizer;
+class MidiPlayer;
 
 class InputHandler {
 public:
     // Callback for quit command
     using QuitCallback = std::function<void()>;
 
+    // Wire format accepted on the Unix socket
+    enum class SocketProtocol {
+        Text,       // Line-based text commands (see processCommand)
+        RawMidi,    // MIDI 1.0 byte stream, running status allowed
+        Binary      // Fixed 4-byte records: status, data1, data2, reserved
+    };
+
+    static constexpr int BINARY_RECORD_SIZE = 4;
+
+    // Bytes read from one client per loop iteration (keeps clients fair)
+    static constexpr int CLIENT_READ_SIZE = 4096;
+
+    // Longest text line a socket client may send; longer ones disconnect it
+    static constexpr size_t MAX_LINE = 65536;
+
+    // Events one begin ... commit block may hold; a bigger block is applied
+    // in parts as it fills up
+    static constexpr size_t MAX_BATCH_EVENTS = 4096;
+
+    // MIDI commands waiting to be applied for one command source.
+    // Commands on one ';'-separated line, or between 'begin' and 'commit',
+    // are collected here and reach the synth under a single lock.
+    struct CommandBatch {
+        std::vector<MidiEvent> events;
+        bool open = false;  // Inside a begin ... commit block
+        int replyFd = -1;   // Where query replies go (-1 = stdout)
+        bool parkOnSleep = false;   // 'sleep' parks this source instead of blocking
+        int64_t resumeNs = 0;       // Parked until then (steady clock), 0 = running
+    };
+
     InputHandler(Synthesizer& synth);
     ~InputHandler();
 
@@ -20,7 +55,8 @@ public:
     void startStdin(QuitCallback onQuit = nullptr);
 
     // Start listening on Unix socket
-    bool startSocket(const std::string& path, QuitCallback onQuit = nullptr);
+    bool startSocket(const std::string& path, QuitCallback onQuit = nullptr,
+                     SocketProtocol protocol = SocketProtocol::Text);
 
     // Stop input handling
     void stop();
@@ -28,19 +64,39 @@ public:
     // Check if running
     bool isRunning() const { return running_.load(); }
 
+    // Attach a MIDI file player for transport commands (tempo)
+    void setPlayer(MidiPlayer* player) { player_ = player; }
+
     // Process a single command line (returns false on quit)
     bool processCommand(const std::string& line);
+    // If a 'sleep' parks the batch, rest (when given) receives where the
+    // line continues once it resumes
+    bool processCommand(const char* line, size_t length, CommandBatch& batch,
+                        const char** rest = nullptr);
 
 private:
     Synthesizer& synth_;
+    MidiPlayer* player_ = nullptr;
     std::atomic<bool> running_{false};
     std::thread inputThread_;
     QuitCallback quitCallback_;
     int socketFd_ = -1;
     std::string socketPath_;
+    SocketProtocol protocol_ = SocketProtocol::Text;
+    RuntimeStats::Source source_ = RuntimeStats::Source::Stdin;
+    int wakeFds_[2] = {-1, -1};  // Self-pipe to interrupt poll() on stop()
+
+    struct Client;
 
+    bool openWakePipe();
     void stdinLoop();
     void socketLoop();
+    bool readClient(Client& client, std::vector<MidiEvent>& batch);
+    bool runClientLines(Client& client);
+    bool runCommand(const char* begin, const char* end, CommandBatch& batch);
+    void flushBatch(CommandBatch& batch);
+    void endBatch(CommandBatch& batch);
+    void reply(const CommandBatch& batch, const std::string& text);
     void cleanup();
 };
 
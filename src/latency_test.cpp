@@ -0,0 +1,339 @@
+#include "latency_test.h"
+#include "synth.h"
+#include "input.h"
+#include "alsa_input.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#ifdef USE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+namespace {
+
+constexpr int PROBE_CHANNEL = 0;
+constexpr int PROBE_NOTE = 60;
+constexpr int PROBE_VELOCITY = 127;
+constexpr int64_t NOTE_TIMEOUT_NS = 1000000000LL;     // Note never sounded
+constexpr int64_t SILENCE_TIMEOUT_NS = 3000000000LL;  // Release never finished
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Shared between the test loop and the enqueue observer (audio thread)
+struct Probe {
+    std::atomic<int64_t> injectNs{0};    // Send time of the pending note (0 = none)
+    std::atomic<int64_t> latencyNs{-1};  // Result for the pending note
+    std::atomic<int64_t> silentSince{0}; // Enqueue time of the first silent buffer in a row
+};
+
+// Sends probe notes through one of the real input paths
+struct Sender {
+    int fd = -1;             // stdin pipe or socket connection (text commands)
+#ifdef USE_ALSA
+    snd_seq_t* seq = nullptr;
+    int port = -1;
+#endif
+
+    bool sendText(const char* line) {
+        size_t length = std::strlen(line);
+        return write(fd, line, length) == static_cast<ssize_t>(length);
+    }
+
+    bool noteOn() {
+#ifdef USE_ALSA
+        if (seq) {
+            snd_seq_event_t ev;
+            snd_seq_ev_clear(&ev);
+            snd_seq_ev_set_source(&ev, port);
+            snd_seq_ev_set_subs(&ev);
+            snd_seq_ev_set_direct(&ev);
+            snd_seq_ev_set_noteon(&ev, PROBE_CHANNEL, PROBE_NOTE, PROBE_VELOCITY);
+            return snd_seq_event_output_direct(seq, &ev) >= 0;
+        }
+#endif
+        return sendText("noteon 0 60 127\n");
+    }
+
+    // Note off plus all sound off, so the next probe starts from silence
+    bool release() {
+#ifdef USE_ALSA
+        if (seq) {
+            snd_seq_event_t ev;
+            snd_seq_ev_clear(&ev);
+            snd_seq_ev_set_source(&ev, port);
+            snd_seq_ev_set_subs(&ev);
+            snd_seq_ev_set_direct(&ev);
+            snd_seq_ev_set_noteoff(&ev, PROBE_CHANNEL, PROBE_NOTE, 0);
+            snd_seq_event_output_direct(seq, &ev);
+            snd_seq_ev_set_controller(&ev, PROBE_CHANNEL, 120, 0);
+            return snd_seq_event_output_direct(seq, &ev) >= 0;
+        }
+#endif
+        return sendText("noteoff 0 60; cc 0 120 0\n");
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+#ifdef USE_ALSA
+        if (seq) {
+            snd_seq_close(seq);
+            seq = nullptr;
+        }
+#endif
+    }
+};
+
+// Connect a text client to the input handler's socket
+bool connectSocket(const std::string& path, Sender& sender) {
+    sender.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sender.fd < 0) {
+        std::fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(sender.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::fprintf(stderr, "Failed to connect to %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+#ifdef USE_ALSA
+// Second sequencer client wired to the synth's port, like an external app
+bool connectAlsa(const AlsaInput& alsa, Sender& sender) {
+    int err = snd_seq_open(&sender.seq, "default", SND_SEQ_OPEN_OUTPUT, 0);
+    if (err < 0) {
+        std::fprintf(stderr, "Failed to open ALSA sequencer: %s\n", snd_strerror(err));
+        sender.seq = nullptr;
+        return false;
+    }
+    snd_seq_set_client_name(sender.seq, "termux-midi-latency-probe");
+    sender.port = snd_seq_create_simple_port(sender.seq, "probe",
+                                             SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                             SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    snd_seq_addr_t dest;
+    if (sender.port < 0 ||
+        snd_seq_parse_address(sender.seq, &dest, alsa.getPortName().c_str()) < 0 ||
+        snd_seq_connect_to(sender.seq, sender.port, dest.client, dest.port) < 0) {
+        std::fprintf(stderr, "Failed to connect to ALSA port %s\n", alsa.getPortName().c_str());
+        return false;
+    }
+    return true;
+}
+#endif
+
+// Wait until `done` holds or the timeout passes
+template <typename Predicate>
+bool waitFor(Predicate done, int64_t timeoutNs) {
+    int64_t deadline = nowNs() + timeoutNs;
+    while (!done()) {
+        if (nowNs() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+}
+
+double percentileMs(const std::vector<int64_t>& sorted, double fraction) {
+    size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index] / 1e6;
+}
+
+const char* sinkName(AudioOutput::Sink sink) {
+    switch (sink) {
+        case AudioOutput::Sink::Null: return "null";
+        case AudioOutput::Sink::Wav: return "wav";
+        default: return "opensl";
+    }
+}
+
+} // namespace
+
+int runLatencyTest(const LatencyOptions& options) {
+    if (options.via != "stdin" && options.via != "socket" && options.via != "alsa") {
+        std::fprintf(stderr, "Unknown input path '%s' (stdin, socket, alsa)\n", options.via.c_str());
+        return 1;
+    }
+
+    Synthesizer synth;
+    if (!synth.loadSoundFont(options.sf2Path)) {
+        return 1;
+    }
+    const int sampleRate = options.sampleRate;
+    const int64_t bufferNs = 1000000000LL * AudioOutput::BUFFER_FRAMES / sampleRate;
+    synth.setOutput(sampleRate, AudioOutput::CHANNELS);
+    synth.programChange(PROBE_CHANNEL, 0);
+
+    // Find each probe's first audible sample as its buffer is enqueued
+    Probe probe;
+    AudioOutput audio;
+    audio.setSink(options.sink, options.wavPath);
+    audio.setSampleRate(sampleRate);
+    audio.setEnqueueObserver([&probe, sampleRate](const int16_t* buffer, int frames, int64_t enqueueNs) {
+        int first = -1;
+        for (int i = 0; i < frames; ++i) {
+            if (buffer[i * 2] != 0 || buffer[i * 2 + 1] != 0) {
+                first = i;
+                break;
+            }
+        }
+
+        if (first < 0) {
+            if (probe.silentSince.load(std::memory_order_relaxed) == 0) {
+                probe.silentSince.store(enqueueNs, std::memory_order_relaxed);
+            }
+            return;
+        }
+        probe.silentSince.store(0, std::memory_order_relaxed);
+
+        int64_t injected = probe.injectNs.load(std::memory_order_acquire);
+        if (injected) {
+            int64_t sampleNs = enqueueNs + static_cast<int64_t>(first) * 1000000000LL / sampleRate;
+            probe.latencyNs.store(sampleNs - injected, std::memory_order_release);
+            probe.injectNs.store(0, std::memory_order_relaxed);
+        }
+    });
+    if (!audio.init([&synth](int16_t* buffer, int frames) {
+        synth.render(buffer, frames);
+    })) {
+        std::fprintf(stderr, "Failed to initialize audio\n");
+        return 1;
+    }
+    if (!audio.start()) {
+        std::fprintf(stderr, "Failed to start audio\n");
+        return 1;
+    }
+
+    // Bring up the input path under test
+    InputHandler input(synth);
+    AlsaInput alsa(synth);
+    Sender sender;
+    int savedStdin = -1;
+    std::string socketPath;
+    bool ready = false;
+
+    if (options.via == "stdin") {
+        // Feed the stdin reader through a pipe standing in for the terminal
+        int fds[2];
+        if (pipe(fds) == 0) {
+            savedStdin = dup(STDIN_FILENO);
+            dup2(fds[0], STDIN_FILENO);
+            ::close(fds[0]);
+            sender.fd = fds[1];
+            input.startStdin();
+            ready = true;
+        } else {
+            std::fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+        }
+    } else if (options.via == "socket") {
+        const char* tmp = std::getenv("TMPDIR");
+        socketPath = std::string(tmp && *tmp ? tmp : "/tmp") + "/termux-midi-latency-" +
+                     std::to_string(getpid()) + ".sock";
+        ready = input.startSocket(socketPath) && connectSocket(socketPath, sender);
+    } else {
+#ifdef USE_ALSA
+        ready = alsa.start("termux-midi-latency") && connectAlsa(alsa, sender);
+#else
+        std::fprintf(stderr, "ALSA support not compiled in\n");
+#endif
+    }
+
+    std::vector<int64_t> latencies;
+    latencies.reserve(options.count);
+    int missed = 0;
+    std::minstd_rand rng(1);
+    std::uniform_int_distribution<int64_t> phase(0, bufferNs);
+
+    for (int i = 0; ready && i < options.count; ++i) {
+        // Start from two silent buffers in a row, then land at a random
+        // point within the buffer period
+        bool quiet = waitFor([&probe, bufferNs] {
+            int64_t since = probe.silentSince.load(std::memory_order_relaxed);
+            return since != 0 && nowNs() - since >= bufferNs;
+        }, SILENCE_TIMEOUT_NS);
+        if (!quiet) {
+            std::fprintf(stderr, "Output did not fall silent; is the release too long?\n");
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::nanoseconds(phase(rng)));
+
+        probe.latencyNs.store(-1, std::memory_order_relaxed);
+        probe.injectNs.store(nowNs(), std::memory_order_release);
+        if (!sender.noteOn()) {
+            std::fprintf(stderr, "Failed to send probe note\n");
+            break;
+        }
+
+        if (waitFor([&probe] { return probe.latencyNs.load(std::memory_order_acquire) >= 0; },
+                    NOTE_TIMEOUT_NS)) {
+            latencies.push_back(probe.latencyNs.load(std::memory_order_relaxed));
+        } else {
+            probe.injectNs.store(0, std::memory_order_relaxed);
+            ++missed;
+        }
+        sender.release();
+    }
+
+    sender.close();
+    input.stop();
+    alsa.stop();
+    audio.stop();
+    if (savedStdin >= 0) {
+        dup2(savedStdin, STDIN_FILENO);
+        ::close(savedStdin);
+    }
+
+    if (latencies.empty()) {
+        std::fprintf(stderr, "No latency measured\n");
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double minMs = latencies.front() / 1e6;
+    double medianMs = percentileMs(latencies, 0.50);
+    double p99Ms = percentileMs(latencies, 0.99);
+    double maxMs = latencies.back() / 1e6;
+    // The other queued buffers play before a freshly enqueued one
+    double queueMs = (AudioOutput::NUM_BUFFERS - 1) * bufferNs / 1e6;
+
+    if (options.json) {
+        std::printf("{\"via\":\"%s\",\"sink\":\"%s\",\"sample_rate\":%d,\"buffer_frames\":%d,"
+                    "\"buffers\":%d,\"notes\":%zu,\"missed\":%d,\"enqueue_ms\":{\"min\":%.3f,"
+                    "\"median\":%.3f,\"p99\":%.3f,\"max\":%.3f},\"queue_ms\":%.3f}\n",
+                    options.via.c_str(), sinkName(options.sink), sampleRate,
+                    AudioOutput::BUFFER_FRAMES, AudioOutput::NUM_BUFFERS, latencies.size(), missed,
+                    minMs, medianMs, p99Ms, maxMs, queueMs);
+        return 0;
+    }
+
+    std::printf("Latency via %s, %s sink: %d x %d frames at %d Hz (%.1f ms per buffer)\n",
+                options.via.c_str(), sinkName(options.sink), AudioOutput::NUM_BUFFERS,
+                AudioOutput::BUFFER_FRAMES, sampleRate, bufferNs / 1e6);
+    std::printf("Notes measured: %zu (%d never sounded)\n", latencies.size(), missed);
+    std::printf("Event to enqueue: min %.2f ms, median %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                minMs, medianMs, p99Ms, maxMs);
+    std::printf("Plus %.1f ms of queued audio ahead of each enqueued buffer\n", queueMs);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef LATENCY_TEST_H
+#define LATENCY_TEST_H
+
+#include "audio.h"
+#include <string>
+
+// End-to-end latency measurement: note-ons are sent through a real input
+// path, and each one is timed until its first audible sample is enqueued.
+struct LatencyOptions {
+    std::string sf2Path;
+    std::string via = "socket";   // Input path: stdin, socket or alsa
+    int count = 100;              // Notes to measure
+    bool json = false;            // Machine-readable output
+    AudioOutput::Sink sink = AudioOutput::Sink::OpenSL;
+    std::string wavPath;
+    int sampleRate = AudioOutput::DEFAULT_SAMPLE_RATE;
+};
+
+// Run the measurement and print the report (returns the process exit code)
+int runLatencyTest(const LatencyOptions& options);
+
+#endif // LATENCY_TEST_H
@@ -2,15 +2,29 @@
 #include "synth.h"
 #include "midi_file.h"
 #include "input.h"
+#include "osc_input.h"
+#include "shm_input.h"
+#include "rawmidi_input.h"
 #include "alsa_input.h"
+#include "bench.h"
+#include "latency_test.h"
+#include "play_server.h"
+#include "render.h"
+#include "thread_policy.h"
+#include "trace.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <strings.h>
 #include <string>
 #include <atomic>
 #include <csignal>
 #include <thread>
 #include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+#include <unistd.h>
 
 #ifndef VERSION
 #define VERSION "1.0.0"
@@ -30,21 +44,62 @@ void printVersion() {
 void printUsage(const char* program) {
     std::printf("Usage: %s <command> [options]\n\n", program);
     std::printf("Commands:\n");
-    std::printf("  play <file.mid>        Play a MIDI file\n");
+    std::printf("  play <file.mid>...     Play one or more MIDI files back to back\n");
     std::printf("  serve                  Run as MIDI service (ALSA sequencer)\n");
     std::printf("  listen                 Real-time mode (text commands from stdin)\n");
     std::printf("  list-instruments       List instruments in soundfont\n");
+    std::printf("  render <file.mid>      Render a MIDI file to WAV, faster than real time\n");
+    std::printf("  bench [file.mid]       Benchmark synthesis without an audio device\n");
+    std::printf("  latency-test           Measure input-to-output latency\n");
     std::printf("\nOptions:\n");
     std::printf("  --sf2 <path>           Path to SoundFont file (.sf2 or .sf3)\n");
     std::printf("  --socket <path>        Listen on Unix socket instead of stdin\n");
+    std::printf("  --socket-mode <mode>   Socket protocol: text (default), raw or binary\n");
+    std::printf("  --osc-port <port>      Also accept OSC messages on a UDP port\n");
+    std::printf("  --osc-bind <address>   Address for --osc-port (default: 127.0.0.1;\n");
+    std::printf("                         0.0.0.0 for other hosts)\n");
+    std::printf("  --shm <name>           Also accept events from a shared-memory ring\n");
+    std::printf("  --rawmidi <device>     Also read a rawmidi device directly (e.g. hw:1,0)\n");
     std::printf("  --name <name>          ALSA client name (default: termux-midi)\n");
+    std::printf("  --ports <n>            ALSA ports for 'serve', 16 channels each (default: 1)\n");
+    std::printf("  --speed <factor>       Playback speed for 'play' (default: 1.0)\n");
+    std::printf("  --playlist <file>      Add MIDI files listed in a file (one per line)\n");
+    std::printf("  --tail                 Let notes ring out before the next file starts\n");
+    std::printf("  --coalesce <ms>        Merge repeated note-ons of a key within <ms>\n");
+    std::printf("  --velocity-floor <v>   Drop note-ons below velocity <v> under overload\n");
+    std::printf("  --max-notes <n>        Cap note-ons per audio buffer\n");
+    std::printf("  --voices <n>           Voices per 'bench' scenario (default: 64)\n");
+    std::printf("  --seconds <s>          Audio rendered per 'bench' scenario (default: 10)\n");
+    std::printf("  --json                 Print 'bench' or 'latency-test' results as JSON\n");
+    std::printf("  --via <stdin|socket|alsa>\n");
+    std::printf("                         Input for 'latency-test' (default: socket)\n");
+    std::printf("  --count <n>            Notes measured by 'latency-test' (default: 100)\n");
+    std::printf("  --sink <sink>          Audio output: device (default), null or a WAV file\n");
+    std::printf("                         (<name>.wav or wav:<path>)\n");
+    std::printf("  --rate <hz>            Output sample rate (default: the device's native rate,\n");
+    std::printf("                         else 44100; 'render' and 'bench': 44100)\n");
+    std::printf("  --out <file.wav>       Output for 'render' (default: the MIDI path with .wav)\n");
+    std::printf("  --stems                'render': one WAV per MIDI channel (<out>.chNN.wav)\n");
+    std::printf("  --interleave           With --stems: one file, a stereo pair per channel\n");
+    std::printf("  --stats-interval <s>   Print a JSON stats line every <s> seconds\n");
+    std::printf("  --trace <file.json>    Record a Chrome/Perfetto trace, written on exit\n");
+    std::printf("  --rt-priority <n>      SCHED_FIFO priority 1-99 for the audio thread (inputs\n");
+    std::printf("                         get n-1); falls back to a raised nice level\n");
+    std::printf("  --cpu-affinity <cpus>  Pin the audio thread to CPUs, e.g. 6-7; <cpus>:<cpus>\n");
+    std::printf("                         puts input threads on the second list\n");
+    std::printf("  --tenant <name>[@gain] Extra synth sharing the soundfont, mixed in at <gain>;\n");
+    std::printf("                         <name> is its socket ('listen') or ALSA client ('serve')\n");
+    std::printf("  --no-handoff           'play': don't use a running daemon; 'listen'/'serve':\n");
+    std::printf("                         don't take files from 'play'\n");
     std::printf("\nReal-time text commands (for 'listen' mode):\n");
     std::printf("  noteon <ch> <note> <vel>   Note on\n");
     std::printf("  noteoff <ch> <note>        Note off\n");
     std::printf("  cc <ch> <ctrl> <val>       Control change\n");
     std::printf("  pc <ch> <prog>             Program change\n");
     std::printf("  pitch <ch> <val>           Pitch bend\n");
+    std::printf("  tempo <factor>             Playback speed ('play' only)\n");
     std::printf("  panic                      All notes off\n");
+    std::printf("  stats                      Reply with a JSON stats line\n");
     std::printf("  quit                       Exit\n");
 #ifdef USE_ALSA
     std::printf("\nALSA support: enabled\n");
@@ -91,57 +146,246 @@ std::string findSoundFont() {
     return "";
 }
 
-int cmdPlay(const std::string& midiFile, const std::string& sf2Path) {
+// Report what the note filter dropped, if it was enabled
+static void printNoteFilterStats(const Synthesizer& synth, const NoteFilter::Config& filter) {
+    if (!filter.enabled()) {
+        return;
+    }
+    NoteFilter::Stats stats = synth.getNoteFilterStats();
+    std::printf("Note filter: %llu merged, %llu below velocity floor, %llu over block cap\n",
+                static_cast<unsigned long long>(stats.merged),
+                static_cast<unsigned long long>(stats.belowFloor),
+                static_cast<unsigned long long>(stats.overCap));
+}
+
+// Periodic --stats-interval logging from a command's wait loop
+class StatsLogger {
+public:
+    StatsLogger(Synthesizer& synth, double interval)
+        : synth_(synth), interval_(interval),
+          next_(std::chrono::steady_clock::now() + toDuration(interval)) {}
+
+    // Print a snapshot if the interval has elapsed
+    void poll() {
+        if (interval_ <= 0.0) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_) {
+            next_ = now + toDuration(interval_);
+            std::printf("%s\n", synth_.getStatsJson().c_str());
+            std::fflush(stdout);
+        }
+    }
+
+private:
+    Synthesizer& synth_;
+    double interval_;
+    std::chrono::steady_clock::time_point next_;
+
+    static std::chrono::steady_clock::duration toDuration(double seconds) {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(seconds));
+    }
+};
+
+// Audio sink chosen with --sink
+struct SinkOption {
+    AudioOutput::Sink sink = AudioOutput::Sink::OpenSL;
+    std::string wavPath;
+    int sampleRate = 0;   // --rate, 0 = pick with outputRate()
+};
+
+// --rate, else the rate the device mixes at, so buffers skip the system
+// resampler; file and null sinks have no device to match
+static int outputRate(const SinkOption& sink) {
+    if (sink.sampleRate > 0) {
+        return sink.sampleRate;
+    }
+    int rate = sink.sink == AudioOutput::Sink::OpenSL ? AudioOutput::nativeSampleRate() : 0;
+    return rate > 0 ? rate : AudioOutput::DEFAULT_SAMPLE_RATE;
+}
+
+// Optional inputs that run alongside the main one in listen and serve
+struct ExtraInputs {
+    int oscPort = -1;
+    std::string oscBind = OscInput::DEFAULT_BIND_ADDRESS;
+    std::string shmName;
+    std::string rawmidiDevice;
+};
+
+// Extra synth instance requested with --tenant
+struct TenantOption {
+    std::string name;   // Socket path for listen, ALSA client name for serve
+    float gain = 1.0f;
+};
+
+// A tenant's synth and the input feeding it
+struct Tenant {
+    std::unique_ptr<Synthesizer> synth;
+    std::unique_ptr<InputHandler> input;
+    std::unique_ptr<AlsaInput> alsa;
+};
+
+// Clone the main synth once per --tenant: only the channel and voice state
+// is per tenant, the soundfont is loaded once
+static bool createTenants(Synthesizer& synth, const std::vector<TenantOption>& options,
+                          const NoteFilter::Config& filter, std::vector<Tenant>& tenants) {
+    for (const TenantOption& option : options) {
+        Tenant tenant;
+        tenant.synth = std::make_unique<Synthesizer>();
+        tenant.synth->setOutput(synth.getSampleRate(), AudioOutput::CHANNELS);
+        if (!tenant.synth->shareSoundFont(synth)) {
+            return false;
+        }
+        tenant.synth->setGain(option.gain);
+        tenant.synth->setNoteFilter(filter);
+        tenants.push_back(std::move(tenant));
+    }
+    return true;
+}
+
+// Start the requested OSC and rawmidi inputs
+static bool startExtraInputs(const ExtraInputs& extra, OscInput& osc, RawMidiInput& rawmidi) {
+    if (extra.oscPort >= 0 && !osc.start(extra.oscPort, extra.oscBind.c_str())) {
+        return false;
+    }
+    if (!extra.rawmidiDevice.empty() && !rawmidi.start(extra.rawmidiDevice)) {
+        return false;
+    }
+    return true;
+}
+
+// What listen and serve share: the main synth and its tenants, the inputs
+// that don't depend on the mode, and the audio stream that mixes them.
+// Members go in reverse order, so the stream stops before the tenants,
+// play server and ring its callback reads.
+struct Daemon {
     Synthesizer synth;
+    ShmInput shm{synth};
+    PlayServer playServer{synth};   // Files handed over by 'play'
+    std::vector<Tenant> tenants;    // Rendered on top of the main synth
+    AudioOutput audio;
+    OscInput osc{synth};
+    RawMidiInput rawmidi{synth};
+};
+
+// Audio callback for listen and serve
+static AudioCallback makeAudioCallback(Daemon& daemon) {
+    return [&daemon](int16_t* buffer, int frames) {
+        RuntimeStats::CallbackTimer timer(daemon.synth.stats(), frames);
+        daemon.shm.drain();   // Shared-memory events are applied right here
+        daemon.synth.render(buffer, frames);
+        daemon.playServer.process(buffer, frames);
+        for (Tenant& tenant : daemon.tenants) {
+            tenant.synth->render(buffer, frames, true);
+        }
+    };
+}
 
+// Load the soundfont, then start tenants, audio and the shared inputs
+static bool startDaemon(Daemon& daemon, const std::string& sf2Path, const ExtraInputs& extra,
+                        const NoteFilter::Config& filter, const SinkOption& sink, bool handOff,
+                        const std::vector<TenantOption>& tenantOptions) {
     std::string soundfont = sf2Path.empty() ? findSoundFont() : sf2Path;
     if (soundfont.empty()) {
         std::fprintf(stderr, "No soundfont found. Use --sf2 or set TERMUX_MIDI_SF2\n");
-        return 1;
+        return false;
     }
 
     std::printf("Loading soundfont: %s\n", soundfont.c_str());
-    if (!synth.loadSoundFont(soundfont)) {
-        return 1;
+    if (!daemon.synth.loadSoundFont(soundfont)) {
+        return false;
     }
 
-    synth.setOutput(AudioOutput::SAMPLE_RATE, AudioOutput::CHANNELS);
+    int sampleRate = outputRate(sink);
+    std::printf("Output: %d Hz\n", sampleRate);
+    daemon.synth.setOutput(sampleRate, AudioOutput::CHANNELS);
+    daemon.synth.setNoteFilter(filter);
 
-    MidiPlayer player(synth);
-    std::printf("Loading MIDI file: %s\n", midiFile.c_str());
-    if (!player.load(midiFile)) {
-        return 1;
+    if (!extra.shmName.empty() && !daemon.shm.start(extra.shmName)) {
+        return false;
+    }
+    if (!createTenants(daemon.synth, tenantOptions, filter, daemon.tenants)) {
+        return false;
     }
 
-    AudioOutput audio;
-    if (!audio.init([&synth, &player](int16_t* buffer, int frames) {
-        player.process(frames);
-        synth.render(buffer, frames);
-    })) {
+    daemon.audio.setSink(sink.sink, sink.wavPath);
+    daemon.audio.setSampleRate(sampleRate);
+    if (!daemon.audio.init(makeAudioCallback(daemon))) {
         std::fprintf(stderr, "Failed to initialize audio\n");
-        return 1;
+        return false;
     }
 
-    player.play();
-    if (!audio.start()) {
+    if (!daemon.audio.start()) {
         std::fprintf(stderr, "Failed to start audio\n");
-        return 1;
+        return false;
     }
 
-    std::printf("Playing... (Ctrl+C to stop)\n");
+    if (!startExtraInputs(extra, daemon.osc, daemon.rawmidi)) {
+        daemon.audio.stop();
+        return false;
+    }
 
-    // Wait for playback to finish or signal
-    while (g_running.load() && !player.isFinished()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // Not fatal: another daemon may already be taking hand-offs
+    if (handOff) {
+        daemon.playServer.start(PlayServer::defaultPath());
     }
+    return true;
+}
 
-    audio.stop();
-    std::printf("Playback finished\n");
+// Stop what startDaemon started, once the mode's own inputs have stopped
+static void stopDaemon(Daemon& daemon) {
+    daemon.osc.stop();
+    daemon.rawmidi.stop();
+    daemon.audio.stop();
+    daemon.playServer.stop();
+}
 
-    return 0;
+// Open and page in a MIDI file off the audio thread
+static std::unique_ptr<MidiStream> preloadMidi(const std::string& path) {
+    auto stream = std::make_unique<MidiStream>();
+    if (!stream->open(path)) {
+        std::fprintf(stderr, "Skipping %s\n", path.c_str());
+        return nullptr;
+    }
+    stream->prefetch();
+    return stream;
+}
+
+// Read a playlist file: one MIDI path per line, '#' starts a comment
+static bool readPlaylist(const std::string& path, std::vector<std::string>& files) {
+    FILE* f = std::fopen(path.c_str(), "r");
+    if (!f) {
+        std::fprintf(stderr, "Failed to open playlist: %s\n", path.c_str());
+        return false;
+    }
+
+    char line[4096];
+    while (std::fgets(line, sizeof(line), f)) {
+        size_t len = std::strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len > 0 && line[0] != '#') {
+            files.push_back(line);
+        }
+    }
+
+    std::fclose(f);
+    return true;
 }
 
-int cmdListen(const std::string& sf2Path, const std::string& socketPath) {
+int cmdPlay(const std::vector<std::string>& midiFiles, const std::string& sf2Path,
+            double speed, bool releaseTail, const std::string& socketPath,
+            const NoteFilter::Config& filter, double statsInterval, const SinkOption& sink,
+            bool handOff) {
+    // A running listen/serve already has the soundfont and audio up
+    if (handOff) {
+        int result = playOnServer(PlayServer::defaultPath(), midiFiles, speed, releaseTail, g_running);
+        if (result >= 0) {
+            return result;
+        }
+    }
+
     Synthesizer synth;
 
     std::string soundfont = sf2Path.empty() ? findSoundFont() : sf2Path;
@@ -155,22 +399,40 @@ int cmdListen(const std::string& sf2Path, const std::string& socketPath) {
         return 1;
     }
 
-    synth.setOutput(AudioOutput::SAMPLE_RATE, AudioOutput::CHANNELS);
+    int sampleRate = outputRate(sink);
+    std::printf("Output: %d Hz\n", sampleRate);
+    synth.setOutput(sampleRate, AudioOutput::CHANNELS);
+    synth.setNoteFilter(filter);
+
+    MidiPlayer player(synth);
+    std::printf("Loading MIDI file: %s\n", midiFiles[0].c_str());
+    if (!player.load(midiFiles[0])) {
+        return 1;
+    }
+    player.setSpeed(speed);
+    player.setReleaseTail(releaseTail);
 
     AudioOutput audio;
-    if (!audio.init([&synth](int16_t* buffer, int frames) {
+    audio.setSink(sink.sink, sink.wavPath);
+    audio.setSampleRate(sampleRate);
+    if (!audio.init([&synth, &player](int16_t* buffer, int frames) {
+        RuntimeStats::CallbackTimer timer(synth.stats(), frames);
+        player.process(frames);
         synth.render(buffer, frames);
     })) {
         std::fprintf(stderr, "Failed to initialize audio\n");
         return 1;
     }
 
+    player.play();
     if (!audio.start()) {
         std::fprintf(stderr, "Failed to start audio\n");
         return 1;
     }
 
+    // Accept live commands (e.g. tempo) on the socket, or on an interactive stdin
     InputHandler input(synth);
+    input.setPlayer(&player);
     auto onQuit = [&]() {
         g_running.store(false);
     };
@@ -180,18 +442,109 @@ int cmdListen(const std::string& sf2Path, const std::string& socketPath) {
             audio.stop();
             return 1;
         }
+    } else if (isatty(STDIN_FILENO)) {
+        input.startStdin(onQuit);
+    }
+
+    std::printf("Playing... (Ctrl+C to stop)\n");
+
+    // Parse the next file in the background while the current one plays;
+    // the player switches over on its own at the exact end sample.
+    size_t nextFile = 1;
+    std::vector<size_t> queuedFiles = {0};
+    std::future<std::unique_ptr<MidiStream>> preload;
+    if (nextFile < midiFiles.size()) {
+        preload = std::async(std::launch::async, preloadMidi, midiFiles[nextFile]);
+    }
+    int announced = 0;
+    StatsLogger stats(synth, statsInterval);
+
+    // Wait for playback to finish or signal
+    while (g_running.load() && (!player.isFinished() || preload.valid())) {
+        if (preload.valid() && !player.hasQueued() &&
+            preload.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            std::unique_ptr<MidiStream> stream = preload.get();
+            if (stream) {
+                player.queue(std::move(stream));
+                queuedFiles.push_back(nextFile);
+                if (player.isFinished()) {
+                    // Preloading fell behind a short file; resume with a gap
+                    player.play();
+                }
+            }
+            if (++nextFile < midiFiles.size()) {
+                preload = std::async(std::launch::async, preloadMidi, midiFiles[nextFile]);
+            }
+        }
+
+        int current = player.songIndex();
+        if (current != announced && current < static_cast<int>(queuedFiles.size())) {
+            announced = current;
+            std::printf("Now playing: %s\n", midiFiles[queuedFiles[current]].c_str());
+        }
+
+        player.releaseRetired();
+        stats.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    input.stop();
+    audio.stop();
+    std::printf("Playback finished\n");
+    printNoteFilterStats(synth, filter);
+
+    return 0;
+}
+
+int cmdListen(const std::string& sf2Path, const std::string& socketPath,
+              InputHandler::SocketProtocol protocol, const ExtraInputs& extra,
+              const NoteFilter::Config& filter, double statsInterval, const SinkOption& sink,
+              bool handOff, const std::vector<TenantOption>& tenantOptions) {
+    Daemon daemon;
+    if (!startDaemon(daemon, sf2Path, extra, filter, sink, handOff, tenantOptions)) {
+        return 1;
+    }
+    Synthesizer& synth = daemon.synth;
+    std::vector<Tenant>& tenants = daemon.tenants;
+
+    InputHandler input(synth);
+    auto onQuit = [&]() {
+        g_running.store(false);
+    };
+
+    if (!socketPath.empty()) {
+        if (!input.startSocket(socketPath, onQuit, protocol)) {
+            stopDaemon(daemon);
+            return 1;
+        }
     } else {
         std::printf("Ready for commands (type 'quit' to exit):\n");
         input.startStdin(onQuit);
     }
 
+    for (size_t i = 0; i < tenants.size(); ++i) {
+        tenants[i].input = std::make_unique<InputHandler>(*tenants[i].synth);
+        if (!tenants[i].input->startSocket(tenantOptions[i].name, nullptr, protocol)) {
+            g_running.store(false);
+            break;
+        }
+    }
+
     // Wait for quit or signal
+    StatsLogger stats(synth, statsInterval);
     while (g_running.load() && input.isRunning()) {
+        stats.poll();
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
     input.stop();
-    audio.stop();
+    for (Tenant& tenant : tenants) {
+        if (tenant.input) {
+            tenant.input->stop();
+        }
+    }
+    stopDaemon(daemon);
+    printNoteFilterStats(synth, filter);
 
     return 0;
 }
@@ -220,34 +573,16 @@ int cmdListInstruments(const std::string& sf2Path) {
     return 0;
 }
 
-int cmdServe(const std::string& sf2Path, const std::string& clientName) {
-    Synthesizer synth;
-
-    std::string soundfont = sf2Path.empty() ? findSoundFont() : sf2Path;
-    if (soundfont.empty()) {
-        std::fprintf(stderr, "No soundfont found. Use --sf2 or set TERMUX_MIDI_SF2\n");
-        return 1;
-    }
-
-    std::printf("Loading soundfont: %s\n", soundfont.c_str());
-    if (!synth.loadSoundFont(soundfont)) {
-        return 1;
-    }
-
-    synth.setOutput(AudioOutput::SAMPLE_RATE, AudioOutput::CHANNELS);
-
-    AudioOutput audio;
-    if (!audio.init([&synth](int16_t* buffer, int frames) {
-        synth.render(buffer, frames);
-    })) {
-        std::fprintf(stderr, "Failed to initialize audio\n");
-        return 1;
-    }
-
-    if (!audio.start()) {
-        std::fprintf(stderr, "Failed to start audio\n");
+int cmdServe(const std::string& sf2Path, const std::string& clientName, int ports,
+             const ExtraInputs& extra, const NoteFilter::Config& filter,
+             double statsInterval, const SinkOption& sink, bool handOff,
+             const std::vector<TenantOption>& tenantOptions) {
+    Daemon daemon;
+    if (!startDaemon(daemon, sf2Path, extra, filter, sink, handOff, tenantOptions)) {
         return 1;
     }
+    Synthesizer& synth = daemon.synth;
+    std::vector<Tenant>& tenants = daemon.tenants;
 
     AlsaInput alsaInput(synth);
     auto onQuit = [&]() {
@@ -255,24 +590,71 @@ int cmdServe(const std::string& sf2Path, const std::string& clientName) {
     };
 
     std::string name = clientName.empty() ? "termux-midi" : clientName;
-    if (!alsaInput.start(name, onQuit)) {
-        audio.stop();
+    if (!alsaInput.start(name, onQuit, ports)) {
+        stopDaemon(daemon);
         return 1;
     }
 
+    for (size_t i = 0; i < tenants.size(); ++i) {
+        tenants[i].alsa = std::make_unique<AlsaInput>(*tenants[i].synth);
+        if (!tenants[i].alsa->start(tenantOptions[i].name)) {
+            g_running.store(false);
+            break;
+        }
+    }
+
     std::printf("MIDI service running (Ctrl+C to stop)\n");
 
     // Wait for quit or signal
+    StatsLogger stats(synth, statsInterval);
     while (g_running.load() && alsaInput.isRunning()) {
+        stats.poll();
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
     alsaInput.stop();
-    audio.stop();
+    for (Tenant& tenant : tenants) {
+        if (tenant.alsa) {
+            tenant.alsa->stop();
+        }
+    }
+    stopDaemon(daemon);
+    printNoteFilterStats(synth, filter);
 
     return 0;
 }
 
+int cmdBench(BenchOptions options, const std::vector<std::string>& midiFiles) {
+    if (options.sf2Path.empty()) {
+        options.sf2Path = findSoundFont();
+    }
+    if (options.sf2Path.empty()) {
+        std::fprintf(stderr, "No soundfont found. Use --sf2 or set TERMUX_MIDI_SF2\n");
+        return 1;
+    }
+    if (!midiFiles.empty()) {
+        options.midiPath = midiFiles[0];
+    }
+    options.version = VERSION;
+    return runBench(options);
+}
+
+int cmdRender(RenderOptions options, const std::vector<std::string>& midiFiles) {
+    if (midiFiles.size() != 1) {
+        std::fprintf(stderr, "Error: 'render' takes exactly one MIDI file\n");
+        return 1;
+    }
+    if (options.sf2Path.empty()) {
+        options.sf2Path = findSoundFont();
+    }
+    if (options.sf2Path.empty()) {
+        std::fprintf(stderr, "No soundfont found. Use --sf2 or set TERMUX_MIDI_SF2\n");
+        return 1;
+    }
+    options.midiPath = midiFiles[0];
+    return runRender(options, g_running);
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         printUsage(argv[0]);
@@ -286,8 +668,24 @@ int main(int argc, char* argv[]) {
     std::string command = argv[1];
     std::string sf2Path;
     std::string socketPath;
-    std::string midiFile;
+    std::vector<std::string> midiFiles;
     std::string clientName;
+    double speed = 1.0;
+    bool releaseTail = false;
+    int alsaPorts = 1;
+    ExtraInputs extra;
+    BenchOptions bench;
+    NoteFilter::Config filter;
+    double statsInterval = 0.0;
+    std::string tracePath;
+    SinkOption sink;
+    LatencyOptions latency;
+    RenderOptions render;
+    bool interleave = false;
+    bool handOff = true;
+    std::vector<TenantOption> tenants;
+    ThreadPolicy::Config threadPolicy;
+    InputHandler::SocketProtocol protocol = InputHandler::SocketProtocol::Text;
 
     // Parse arguments
     for (int i = 2; i < argc; ++i) {
@@ -297,11 +695,175 @@ int main(int argc, char* argv[]) {
         else if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
             socketPath = argv[++i];
         }
+        else if (std::strcmp(argv[i], "--socket-mode") == 0 && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "text") {
+                protocol = InputHandler::SocketProtocol::Text;
+            } else if (mode == "raw") {
+                protocol = InputHandler::SocketProtocol::RawMidi;
+            } else if (mode == "binary") {
+                protocol = InputHandler::SocketProtocol::Binary;
+            } else {
+                std::fprintf(stderr, "Error: unknown socket mode '%s' (text, raw, binary)\n", mode.c_str());
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--osc-port") == 0 && i + 1 < argc) {
+            extra.oscPort = std::atoi(argv[++i]);
+            if (extra.oscPort < 0 || extra.oscPort > 65535) {
+                std::fprintf(stderr, "Error: --osc-port must be between 0 and 65535\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--osc-bind") == 0 && i + 1 < argc) {
+            extra.oscBind = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            extra.shmName = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--rawmidi") == 0 && i + 1 < argc) {
+            extra.rawmidiDevice = argv[++i];
+        }
         else if (std::strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
             clientName = argv[++i];
         }
-        else if (argv[i][0] != '-' && midiFile.empty()) {
-            midiFile = argv[i];
+        else if (std::strcmp(argv[i], "--ports") == 0 && i + 1 < argc) {
+            alsaPorts = std::atoi(argv[++i]);
+            if (alsaPorts < 1 || alsaPorts > AlsaInput::MAX_PORTS) {
+                std::fprintf(stderr, "Error: --ports must be between 1 and %d\n", AlsaInput::MAX_PORTS);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+            if (speed < MidiPlayer::MIN_SPEED || speed > MidiPlayer::MAX_SPEED) {
+                std::fprintf(stderr, "Error: --speed must be between %.2f and %.1f\n",
+                             MidiPlayer::MIN_SPEED, MidiPlayer::MAX_SPEED);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--playlist") == 0 && i + 1 < argc) {
+            if (!readPlaylist(argv[++i], midiFiles)) {
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--tail") == 0) {
+            releaseTail = true;
+        }
+        else if (std::strcmp(argv[i], "--coalesce") == 0 && i + 1 < argc) {
+            filter.coalesceMs = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--velocity-floor") == 0 && i + 1 < argc) {
+            filter.velocityFloor = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--max-notes") == 0 && i + 1 < argc) {
+            filter.maxNotesPerBlock = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            bench.voices = std::atoi(argv[++i]);
+            if (bench.voices < 1) {
+                std::fprintf(stderr, "Error: --voices must be at least 1\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            bench.seconds = std::atof(argv[++i]);
+            if (bench.seconds <= 0) {
+                std::fprintf(stderr, "Error: --seconds must be positive\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--json") == 0) {
+            bench.json = true;
+            latency.json = true;
+        }
+        else if (std::strcmp(argv[i], "--via") == 0 && i + 1 < argc) {
+            latency.via = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            latency.count = std::atoi(argv[++i]);
+            if (latency.count < 1) {
+                std::fprintf(stderr, "Error: --count must be at least 1\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--sink") == 0 && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "device") {
+                sink.sink = AudioOutput::Sink::OpenSL;
+            } else if (value == "null") {
+                sink.sink = AudioOutput::Sink::Null;
+            } else if (value.compare(0, 4, "wav:") == 0 && value.size() > 4) {
+                sink.sink = AudioOutput::Sink::Wav;
+                sink.wavPath = value.substr(4);
+            } else if (value.size() > 4 && strcasecmp(value.c_str() + value.size() - 4, ".wav") == 0) {
+                sink.sink = AudioOutput::Sink::Wav;
+                sink.wavPath = value;
+            } else {
+                // A typo such as 'nul' must not quietly become a file name
+                std::fprintf(stderr, "Error: --sink takes device, null, <name>.wav or wav:<path>\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            sink.sampleRate = std::atoi(argv[++i]);
+            if (sink.sampleRate < AudioOutput::MIN_SAMPLE_RATE || sink.sampleRate > AudioOutput::MAX_SAMPLE_RATE) {
+                std::fprintf(stderr, "Error: --rate must be between %d and %d\n",
+                             AudioOutput::MIN_SAMPLE_RATE, AudioOutput::MAX_SAMPLE_RATE);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            render.outPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--stems") == 0) {
+            render.stems = RenderOptions::Stems::Files;
+        }
+        else if (std::strcmp(argv[i], "--interleave") == 0) {
+            interleave = true;
+        }
+        else if (std::strcmp(argv[i], "--tenant") == 0 && i + 1 < argc) {
+            TenantOption tenant;
+            tenant.name = argv[++i];
+            size_t at = tenant.name.rfind('@');
+            if (at != std::string::npos) {
+                tenant.gain = static_cast<float>(std::atof(tenant.name.c_str() + at + 1));
+                tenant.name.erase(at);
+            }
+            if (tenant.name.empty() || tenant.gain < 0.0f) {
+                std::fprintf(stderr, "Error: --tenant takes <name>[@gain] with a gain of 0 or more\n");
+                return 1;
+            }
+            tenants.push_back(tenant);
+        }
+        else if (std::strcmp(argv[i], "--no-handoff") == 0) {
+            handOff = false;
+        }
+        else if (std::strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+            threadPolicy.rtPriority = std::atoi(argv[++i]);
+            if (threadPolicy.rtPriority < 1 || threadPolicy.rtPriority > ThreadPolicy::MAX_RT_PRIORITY) {
+                std::fprintf(stderr, "Error: --rt-priority must be between 1 and %d\n", ThreadPolicy::MAX_RT_PRIORITY);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--cpu-affinity") == 0 && i + 1 < argc) {
+            if (!ThreadPolicy::parseAffinity(argv[++i], threadPolicy)) {
+                std::fprintf(stderr, "Error: --cpu-affinity takes CPU lists like 6-7 or 7:4-6\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            statsInterval = std::atof(argv[++i]);
+            if (statsInterval <= 0) {
+                std::fprintf(stderr, "Error: --stats-interval must be positive\n");
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-') {
+            midiFiles.push_back(argv[i]);
         }
         else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
             printUsage(argv[0]);
@@ -309,23 +871,82 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // The trace covers the whole run and is written once everything stopped
+    if (!tracePath.empty()) {
+        Trace::enable();
+        Trace::registerThread("main");
+    }
+    // Threads pick the policy up as they start
+    ThreadPolicy::configure(threadPolicy);
+
+    auto finish = [&tracePath](int result) {
+        if (!tracePath.empty() && !Trace::write(tracePath)) {
+            return 1;
+        }
+        return result;
+    };
+
     if (command == "play") {
-        if (midiFile.empty()) {
+        if (midiFiles.empty()) {
             std::fprintf(stderr, "Error: No MIDI file specified\n");
             printUsage(argv[0]);
             return 1;
         }
-        return cmdPlay(midiFile, sf2Path);
+        // Options that only apply to a local synth keep playback in-process
+        bool playHandOff = handOff && sf2Path.empty() && socketPath.empty() &&
+                           sink.sink == AudioOutput::Sink::OpenSL && sink.sampleRate == 0 &&
+                           !filter.enabled() && statsInterval <= 0.0 && tracePath.empty();
+        return finish(cmdPlay(midiFiles, sf2Path, speed, releaseTail, socketPath, filter, statsInterval, sink,
+                              playHandOff));
     }
     else if (command == "serve") {
-        return cmdServe(sf2Path, clientName);
+        // ALSA ports are 16 channels each; OSC can address all of them
+        filter.channels = extra.oscPort >= 0 ? NoteFilter::CHANNELS : alsaPorts * 16;
+        return finish(cmdServe(sf2Path, clientName, alsaPorts, extra, filter, statsInterval, sink, handOff, tenants));
     }
     else if (command == "listen") {
-        return cmdListen(sf2Path, socketPath);
+        filter.channels = NoteFilter::CHANNELS;   // Text and OSC reach channel 255
+        return finish(cmdListen(sf2Path, socketPath, protocol, extra, filter, statsInterval, sink, handOff,
+                                tenants));
     }
     else if (command == "list-instruments") {
         return cmdListInstruments(sf2Path);
     }
+    else if (command == "render") {
+        if (interleave) {
+            if (render.stems == RenderOptions::Stems::None) {
+                std::fprintf(stderr, "Error: --interleave needs --stems\n");
+                return 1;
+            }
+            render.stems = RenderOptions::Stems::Interleaved;
+        }
+        render.sf2Path = sf2Path;
+        render.speed = speed;
+        if (sink.sampleRate > 0) {
+            render.sampleRate = sink.sampleRate;
+        }
+        ThreadPolicy::apply(ThreadPolicy::Role::Render, "render");
+        return finish(cmdRender(render, midiFiles));
+    }
+    else if (command == "bench") {
+        bench.sf2Path = sf2Path;
+        if (sink.sampleRate > 0) {
+            bench.sampleRate = sink.sampleRate;
+        }
+        ThreadPolicy::apply(ThreadPolicy::Role::Render, "bench");
+        return cmdBench(bench, midiFiles);
+    }
+    else if (command == "latency-test") {
+        latency.sf2Path = sf2Path.empty() ? findSoundFont() : sf2Path;
+        if (latency.sf2Path.empty()) {
+            std::fprintf(stderr, "No soundfont found. Use --sf2 or set TERMUX_MIDI_SF2\n");
+            return 1;
+        }
+        latency.sink = sink.sink;
+        latency.wavPath = sink.wavPath;
+        latency.sampleRate = outputRate(sink);
+        return finish(runLatencyTest(latency));
+    }
     else if (command == "--help" || command == "-h") {
         printUsage(argv[0]);
         return 0;
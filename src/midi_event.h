@@ -0,0 +1,29 @@
+#ifndef MIDI_EVENT_H
+#define MIDI_EVENT_H
+
+#include <cstdint>
+
+// Channel message types (status byte high nibble)
+enum MidiEventType : uint8_t {
+    MIDI_NOTE_OFF = 0x80,
+    MIDI_NOTE_ON = 0x90,
+    MIDI_KEY_PRESSURE = 0xA0,
+    MIDI_CONTROL_CHANGE = 0xB0,
+    MIDI_PROGRAM_CHANGE = 0xC0,
+    MIDI_CHANNEL_PRESSURE = 0xD0,
+    MIDI_PITCH_BEND = 0xE0
+};
+
+// A single channel message
+struct MidiEvent {
+    double time = 0.0;   // Milliseconds from start of file (0 for live input),
+                         // or the render frame for Synthesizer::scheduleEvents
+    uint8_t type = 0;    // MidiEventType
+    uint8_t channel = 0;
+    uint8_t param1 = 0;  // key / controller / program
+    uint8_t param2 = 0;  // velocity / value
+
+    int pitchBend() const { return param1 | (param2 << 7); }
+};
+
+#endif // MIDI_EVENT_H
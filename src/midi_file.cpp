@@ -1,40 +1,59 @@
-#define TML_IMPLEMENTATION
-#include "../vendor/tml.h"
 #include "midi_file.h"
 #include "synth.h"
+#include "trace.h"
 #include <cstdio>
 
 MidiPlayer::MidiPlayer(Synthesizer& synth)
-    : synth_(synth) {
+    : synth_(synth), stats_(&synth.stats()) {
 }
 
 MidiPlayer::~MidiPlayer() {
-    if (midi_) {
-        tml_free(midi_);
-    }
+    delete next_.exchange(nullptr);
+    releaseRetired();
 }
 
 bool MidiPlayer::load(const std::string& path) {
-    if (midi_) {
-        tml_free(midi_);
-        midi_ = nullptr;
-    }
-
-    midi_ = tml_load_filename(path.c_str());
-    if (!midi_) {
+    auto stream = std::make_unique<MidiStream>();
+    if (!stream->open(path)) {
         std::fprintf(stderr, "Failed to load MIDI file: %s\n", path.c_str());
         return false;
     }
 
-    current_ = midi_;
+    stream_ = std::move(stream);
+    sampleRate_ = synth_.getSampleRate();
     currentTime_ = 0.0;
+    songIndex_.store(0);
     finished_.store(false);
 
     return true;
 }
 
+bool MidiPlayer::queue(std::unique_ptr<MidiStream> next) {
+    MidiStream* expected = nullptr;
+    if (!next_.compare_exchange_strong(expected, next.get())) {
+        return false;
+    }
+    next.release();
+    return true;
+}
+
+void MidiPlayer::releaseRetired() {
+    for (std::atomic<MidiStream*>& retired : retired_) {
+        delete retired.exchange(nullptr);
+    }
+}
+
 void MidiPlayer::play() {
-    if (midi_ && !finished_.load()) {
+    if (!stream_) {
+        return;
+    }
+
+    // A stream queued after the previous one ran out resumes playback
+    if (finished_.load() && hasQueued()) {
+        finished_.store(false);
+    }
+
+    if (!finished_.load()) {
         playing_.store(true);
     }
 }
@@ -46,60 +65,116 @@ void MidiPlayer::stop() {
 
 void MidiPlayer::reset() {
     stop();
-    current_ = midi_;
+    if (stream_) {
+        stream_->rewind();
+    }
     currentTime_ = 0.0;
     finished_.store(false);
 }
 
+void MidiPlayer::setSpeed(double speed) {
+    if (speed < MIN_SPEED) {
+        speed = MIN_SPEED;
+    } else if (speed > MAX_SPEED) {
+        speed = MAX_SPEED;
+    }
+    speed_.store(speed, std::memory_order_relaxed);
+}
+
+void MidiPlayer::dispatch(const MidiEvent& ev) {
+    switch (ev.type) {
+        case MIDI_NOTE_ON:
+            if (ev.param2 > 0) {
+                synth_.noteOn(ev.channel, ev.param1, ev.param2 / 127.0f);
+            } else {
+                synth_.noteOff(ev.channel, ev.param1);
+            }
+            break;
+
+        case MIDI_NOTE_OFF:
+            synth_.noteOff(ev.channel, ev.param1);
+            break;
+
+        case MIDI_CONTROL_CHANGE:
+            synth_.controlChange(ev.channel, ev.param1, ev.param2);
+            break;
+
+        case MIDI_PROGRAM_CHANGE:
+            synth_.programChange(ev.channel, ev.param1);
+            break;
+
+        case MIDI_PITCH_BEND:
+            synth_.pitchBend(ev.channel, ev.pitchBend());
+            break;
+
+        default:
+            // Ignore other message types (aftertouch)
+            break;
+    }
+}
+
 void MidiPlayer::process(int samples) {
-    if (!playing_.load() || !current_) {
+    if (!playing_.load() || !stream_) {
         return;
     }
+    TraceSpan span("player.process");
 
-    // Convert samples to milliseconds
+    // Convert samples to milliseconds of file time, scaled by playback speed
     double msPerSample = 1000.0 / sampleRate_;
-    double targetTime = currentTime_ + (samples * msPerSample);
-
-    // Process all MIDI events up to the target time
-    while (current_ && current_->time <= targetTime) {
-        switch (current_->type) {
-            case TML_NOTE_ON:
-                if (current_->velocity > 0) {
-                    synth_.noteOn(current_->channel, current_->key, current_->velocity / 127.0f);
-                } else {
-                    synth_.noteOff(current_->channel, current_->key);
-                }
-                break;
-
-            case TML_NOTE_OFF:
-                synth_.noteOff(current_->channel, current_->key);
-                break;
-
-            case TML_CONTROL_CHANGE:
-                synth_.controlChange(current_->channel, current_->control, current_->control_value);
-                break;
+    double speed = speed_.load(std::memory_order_relaxed);
+    double targetTime = currentTime_ + (samples * msPerSample * speed);
+
+    int dispatched = 0;
+    for (;;) {
+        // Process all MIDI events up to the target time
+        const MidiEvent* ev;
+        while ((ev = stream_->peek()) && ev->time <= targetTime) {
+            dispatch(*ev);
+            stream_->pop();
+            ++dispatched;
+        }
 
-            case TML_PROGRAM_CHANGE:
-                synth_.programChange(current_->channel, current_->program);
-                break;
+        // Wait for the file's trailing silence and, if requested, the release tail
+        if (ev || targetTime < stream_->endTime()) {
+            break;
+        }
+        double tailMs = (targetTime - stream_->endTime()) / speed;
+        if (releaseTail_.load() && synth_.getActiveVoiceCount() > 0 &&
+            tailMs < MAX_TAIL_SECONDS * 1000.0) {
+            break;
+        }
 
-            case TML_PITCH_BEND:
-                synth_.pitchBend(current_->channel, current_->pitch_bend);
+        // The finished stream needs a free retired slot; until the main
+        // thread empties one, stay at the end of this file
+        std::atomic<MidiStream*>* retired = nullptr;
+        for (std::atomic<MidiStream*>& slot : retired_) {
+            if (!slot.load()) {
+                retired = &slot;
                 break;
+            }
+        }
+        if (!retired) {
+            break;
+        }
 
-            default:
-                // Ignore other message types (sysex, meta, etc.)
-                break;
+        // Reached the end: hand over to the queued file if there is one
+        MidiStream* next = next_.exchange(nullptr);
+        if (!next) {
+            finished_.store(true);
+            playing_.store(false);
+            break;
         }
 
-        current_ = current_->next;
+        // Carry the time elapsed past the end into the next file so it starts
+        // on the exact sample the previous one ended. Unmapping happens later
+        // on the main thread via releaseRetired().
+        targetTime = releaseTail_.load() ? 0.0 : targetTime - stream_->endTime();
+        retired->store(stream_.release());
+        stream_.reset(next);
+        songIndex_.fetch_add(1);
     }
 
     currentTime_ = targetTime;
-
-    // Check if we've reached the end
-    if (!current_) {
-        finished_.store(true);
-        playing_.store(false);
-    }
+    stats_->countEvents(RuntimeStats::Source::File, dispatched);
+    span.setCount(dispatched);
 }
@@ -1,13 +1,13 @@
 #ifndef MIDI_FILE_H
 #define MIDI_FILE_H
 
+#include "midi_stream.h"
 #include <string>
 #include <atomic>
+#include <memory>
 
 class Synthesizer;
-
-// Forward declare TML
-struct tml_message;
+class RuntimeStats;
 
 class MidiPlayer {
 public:
@@ -36,14 +36,56 @@ public:
     // Reset to beginning
     void reset();
 
+    // Playback rate multiplier (1.0 = as written, 2.0 = twice as fast).
+    // Scales the playback clock only, so it is safe to call from any thread
+    // and takes effect at the next processed block.
+    void setSpeed(double speed);
+    double getSpeed() const { return speed_.load(std::memory_order_relaxed); }
+
+    static constexpr double MIN_SPEED = 0.05;
+    static constexpr double MAX_SPEED = 8.0;
+
+    // Queue an opened stream to take over when the current file ends.
+    // The handover happens inside process() at the exact end time of the
+    // current file, so consecutive files play without a gap.
+    // Returns false if a stream is already queued.
+    bool queue(std::unique_ptr<MidiStream> next);
+
+    // Check if a stream is waiting to take over
+    bool hasQueued() const { return next_.load() != nullptr; }
+
+    // Number of handovers performed since load()
+    int songIndex() const { return songIndex_.load(); }
+
+    // Let the synth's release tail fade out before the next file starts,
+    // for at most MAX_TAIL_SECONDS (looped or pedal-held voices never end)
+    void setReleaseTail(bool enabled) { releaseTail_.store(enabled); }
+    static constexpr double MAX_TAIL_SECONDS = 10.0;
+
+    // Free streams retired by the audio thread (call from a non-audio thread)
+    void releaseRetired();
+
+    // Count dispatched events in stats instead of the synth's own counters
+    void setStats(RuntimeStats& stats) { stats_ = &stats; }
+
 private:
     Synthesizer& synth_;
-    tml_message* midi_ = nullptr;
-    tml_message* current_ = nullptr;
+    RuntimeStats* stats_;
+    std::unique_ptr<MidiStream> stream_;
+    std::atomic<MidiStream*> next_{nullptr};
+    // Streams the audio thread is done with, freed by releaseRetired(); a
+    // handover waits while all are taken so process() never unmaps one
+    static constexpr int RETIRED_SLOTS = 4;
+    std::atomic<MidiStream*> retired_[RETIRED_SLOTS] = {};
+    std::atomic<int> songIndex_{0};
+    std::atomic<bool> releaseTail_{false};
     double currentTime_ = 0.0;  // Current playback time in milliseconds
-    int sampleRate_ = 44100;
+    int sampleRate_ = 44100;    // The synth's output rate, taken at load()
+    std::atomic<double> speed_{1.0};
     std::atomic<bool> playing_{false};
     std::atomic<bool> finished_{false};
+
+    void dispatch(const MidiEvent& ev);
 };
 
 #endif // MIDI_FILE_H
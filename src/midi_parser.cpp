@@ -0,0 +1,63 @@
+#include "midi_parser.h"
+
+bool MidiParser::feed(uint8_t byte, MidiEvent& ev) {
+    // Realtime messages may be interleaved anywhere and carry no state
+    if (byte >= 0xF8) {
+        return false;
+    }
+
+    if (byte & 0x80) {
+        count_ = 0;
+        if (byte == 0xF0) {
+            sysex_ = true;
+            status_ = 0;
+        } else if (byte == 0xF7) {
+            sysex_ = false;
+        } else if (byte > 0xF0) {
+            // System common cancels running status; its data bytes are dropped
+            sysex_ = false;
+            status_ = 0;
+        } else {
+            sysex_ = false;
+            status_ = byte;
+            uint8_t type = byte & 0xF0;
+            needed_ = (type == MIDI_PROGRAM_CHANGE || type == MIDI_CHANNEL_PRESSURE) ? 1 : 2;
+        }
+        return false;
+    }
+
+    if (sysex_ || !status_) {
+        return false;
+    }
+
+    data_[count_++] = byte;
+    if (count_ < needed_) {
+        return false;
+    }
+
+    // Keep status_ for running status
+    count_ = 0;
+    ev.time = 0.0;
+    ev.type = status_ & 0xF0;
+    ev.channel = status_ & 0x0F;
+    ev.param1 = data_[0];
+    ev.param2 = needed_ == 2 ? data_[1] : 0;
+    return true;
+}
+
+int MidiParser::decode(const uint8_t* data, size_t size, MidiEvent* events) {
+    int count = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (feed(data[i], events[count])) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void MidiParser::reset() {
+    status_ = 0;
+    count_ = 0;
+    needed_ = 0;
+    sysex_ = false;
+}
@@ -0,0 +1,32 @@
+#ifndef MIDI_PARSER_H
+#define MIDI_PARSER_H
+
+#include "midi_event.h"
+#include <cstddef>
+#include <cstdint>
+
+// Incremental decoder for MIDI 1.0 byte streams (wire format).
+// Handles running status, skips SysEx and system common messages, and
+// ignores realtime bytes wherever they appear.
+class MidiParser {
+public:
+    // Feed one byte, returns true when ev holds a complete channel message
+    bool feed(uint8_t byte, MidiEvent& ev);
+
+    // Decode a whole buffer into events, returns the number written.
+    // A byte stream never yields more events than bytes, so an events
+    // array of 'size' entries is always large enough.
+    int decode(const uint8_t* data, size_t size, MidiEvent* events);
+
+    // Forget running status and any partial message
+    void reset();
+
+private:
+    uint8_t status_ = 0;
+    uint8_t data_[2] = {0, 0};
+    int count_ = 0;
+    int needed_ = 0;
+    bool sysex_ = false;
+};
+
+#endif // MIDI_PARSER_H
@@ -0,0 +1,292 @@
+#include "midi_stream.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint32_t readBE32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static uint16_t readBE16(const uint8_t* p) {
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+// Read a variable-length quantity, returns false on truncated data
+static bool readVarLen(const uint8_t*& pos, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (pos >= end) {
+            return false;
+        }
+        uint8_t c = *pos++;
+        value = (value << 7) | (c & 0x7F);
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MidiStream::MidiStream() = default;
+
+MidiStream::~MidiStream() {
+    close();
+}
+
+bool MidiStream::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::fprintf(stderr, "Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 14) {
+        std::fprintf(stderr, "Not a MIDI file: %s\n", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::fprintf(stderr, "Failed to map %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Tracks are consumed front to back, let the kernel read ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    data_ = static_cast<const uint8_t*>(map);
+    size_ = static_cast<size_t>(st.st_size);
+
+    // Parse MThd header
+    uint32_t headerLen = readBE32(data_ + 4);
+    if (std::memcmp(data_, "MThd", 4) != 0 || headerLen < 6 || 8 + headerLen > size_) {
+        std::fprintf(stderr, "Not a MIDI file: invalid MThd header\n");
+        close();
+        return false;
+    }
+
+    int numTracks = readBE16(data_ + 10);
+    int division = readBE16(data_ + 12);
+    if (division & 0x8000) {
+        std::fprintf(stderr, "MIDI file uses unsupported SMPTE timing\n");
+        close();
+        return false;
+    }
+    division_ = division > 0 ? division : 480;
+
+    // Locate track chunks, skipping unknown chunk types
+    size_t offset = 8 + headerLen;
+    while (offset + 8 <= size_ && static_cast<int>(tracks_.size()) < numTracks) {
+        const uint8_t* chunk = data_ + offset;
+        size_t length = readBE32(chunk + 4);
+        size_t available = size_ - offset - 8;
+
+        if (std::memcmp(chunk, "MTrk", 4) == 0) {
+            Track t;
+            t.begin = chunk + 8;
+            t.end = t.begin + std::min(length, available);
+            tracks_.push_back(t);
+        }
+
+        if (length > available) {
+            break;
+        }
+        offset += 8 + length;
+    }
+
+    if (tracks_.empty()) {
+        std::fprintf(stderr, "MIDI file contains no tracks\n");
+        close();
+        return false;
+    }
+
+    heap_.reserve(tracks_.size());
+    rewind();
+
+    return true;
+}
+
+void MidiStream::close() {
+    if (data_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+    tracks_.clear();
+    heap_.clear();
+    hasPending_ = false;
+}
+
+void MidiStream::prefetch() const {
+    if (!data_) {
+        return;
+    }
+
+    madvise(const_cast<uint8_t*>(data_), size_, MADV_WILLNEED);
+
+    // Touch every page so the playback thread never takes a major fault
+    long pageSize = sysconf(_SC_PAGESIZE);
+    volatile uint8_t sink = 0;
+    for (size_t offset = 0; offset < size_; offset += pageSize) {
+        sink = sink + data_[offset];
+    }
+}
+
+void MidiStream::rewind() {
+    // Default tempo is 120 BPM (500000 us per quarter note)
+    endTick_ = 0;
+    tempoTick_ = 0;
+    tempoTime_ = 0.0;
+    msPerTick_ = 500.0 / division_;
+    hasPending_ = false;
+
+    heap_.clear();
+    for (size_t i = 0; i < tracks_.size(); ++i) {
+        Track& t = tracks_[i];
+        t.pos = t.begin;
+        t.tick = 0;
+        t.runningStatus = 0;
+        if (readDelta(t)) {
+            heap_.push_back(static_cast<int>(i));
+        }
+    }
+
+    std::make_heap(heap_.begin(), heap_.end(), [this](int a, int b) { return laterThan(a, b); });
+}
+
+bool MidiStream::laterThan(int a, int b) const {
+    // Ties go to the lower track index so same-tick events keep file order
+    return tracks_[a].tick > tracks_[b].tick || (tracks_[a].tick == tracks_[b].tick && a > b);
+}
+
+double MidiStream::tickToMs(uint32_t tick) const {
+    return tempoTime_ + (tick - tempoTick_) * msPerTick_;
+}
+
+bool MidiStream::readDelta(Track& t) {
+    uint32_t delta;
+    if (!readVarLen(t.pos, t.end, delta)) {
+        return false;
+    }
+
+    // Throw away delays that are insanely high for malformed files
+    if (delta & 0xFFF00000) {
+        delta = 0;
+    }
+    t.tick += delta;
+    return true;
+}
+
+bool MidiStream::readEvent(Track& t, MidiEvent& ev) {
+    if (t.pos >= t.end) {
+        return false;
+    }
+
+    uint8_t status = *t.pos;
+    if (status & 0x80) {
+        ++t.pos;
+    } else if (t.runningStatus) {
+        status = t.runningStatus;
+    } else {
+        // Data byte without running status: give up on this track
+        t.pos = t.end;
+        return false;
+    }
+
+    if (status == 0xFF) {
+        // Meta event
+        uint32_t length;
+        if (t.pos >= t.end) {
+            t.pos = t.end;
+            return false;
+        }
+        uint8_t metaType = *t.pos++;
+        if (!readVarLen(t.pos, t.end, length) || length > static_cast<size_t>(t.end - t.pos)) {
+            t.pos = t.end;
+            return false;
+        }
+
+        if (metaType == 0x2F) {
+            // End of track
+            t.pos = t.end;
+        } else if (metaType == 0x51 && length == 3) {
+            // Set tempo: rebase the tick to time mapping at this tick
+            uint32_t usPerQuarter = (uint32_t(t.pos[0]) << 16) | (uint32_t(t.pos[1]) << 8) | t.pos[2];
+            tempoTime_ = tickToMs(t.tick);
+            tempoTick_ = t.tick;
+            msPerTick_ = usPerQuarter / (1000.0 * division_);
+        }
+
+        t.pos += length;
+        return false;
+    }
+
+    if (status == 0xF0 || status == 0xF7) {
+        // SysEx is not handled, skip its payload
+        uint32_t length;
+        if (!readVarLen(t.pos, t.end, length) || length > static_cast<size_t>(t.end - t.pos)) {
+            t.pos = t.end;
+            return false;
+        }
+        t.pos += length;
+        return false;
+    }
+
+    if (status >= 0xF0) {
+        // System common/realtime bytes are not valid in a track
+        t.pos = t.end;
+        return false;
+    }
+
+    // Channel message
+    t.runningStatus = status;
+    uint8_t type = status & 0xF0;
+    int dataBytes = (type == MIDI_PROGRAM_CHANGE || type == MIDI_CHANNEL_PRESSURE) ? 1 : 2;
+    if (t.end - t.pos < dataBytes) {
+        t.pos = t.end;
+        return false;
+    }
+
+    ev.type = type;
+    ev.channel = status & 0x0F;
+    ev.param1 = t.pos[0] & 0x7F;
+    ev.param2 = dataBytes == 2 ? (t.pos[1] & 0x7F) : 0;
+    t.pos += dataBytes;
+    return true;
+}
+
+const MidiEvent* MidiStream::peek() {
+    auto later = [this](int a, int b) { return laterThan(a, b); };
+
+    while (!hasPending_ && !heap_.empty()) {
+        std::pop_heap(heap_.begin(), heap_.end(), later);
+        int index = heap_.back();
+        heap_.pop_back();
+
+        Track& t = tracks_[index];
+        if (readEvent(t, pending_)) {
+            pending_.time = tickToMs(t.tick);
+            hasPending_ = true;
+        }
+
+        // Re-queue the track keyed on its following event
+        if (t.pos < t.end && readDelta(t)) {
+            heap_.push_back(index);
+            std::push_heap(heap_.begin(), heap_.end(), later);
+        } else if (t.tick > endTick_) {
+            endTick_ = t.tick;
+        }
+    }
+
+    return hasPending_ ? &pending_ : nullptr;
+}
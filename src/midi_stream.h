@@ -0,0 +1,77 @@
+#ifndef MIDI_STREAM_H
+#define MIDI_STREAM_H
+
+#include "midi_event.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Streaming Standard MIDI File reader.
+// The file is memory-mapped and each track keeps its own cursor; tracks are
+// merged lazily through a min-heap keyed on the next event tick, so memory
+// is proportional to the track count rather than the event count.
+class MidiStream {
+public:
+    MidiStream();
+    ~MidiStream();
+
+    MidiStream(const MidiStream&) = delete;
+    MidiStream& operator=(const MidiStream&) = delete;
+
+    // Map a MIDI file and locate its tracks
+    bool open(const std::string& path);
+
+    // Unmap the file
+    void close();
+
+    // Check if a file is open
+    bool isOpen() const { return data_ != nullptr; }
+
+    // Restart from the first event
+    void rewind();
+
+    // Next channel event without consuming it (nullptr at end of file)
+    const MidiEvent* peek();
+
+    // Consume the event returned by peek()
+    void pop() { hasPending_ = false; }
+
+    // Time of the last track end (including trailing silence before the
+    // End of Track meta events). Final once peek() has returned nullptr.
+    double endTime() const { return tickToMs(endTick_); }
+
+    // Fault the mapped file into memory ahead of playback
+    void prefetch() const;
+
+private:
+    struct Track {
+        const uint8_t* begin = nullptr;
+        const uint8_t* end = nullptr;
+        const uint8_t* pos = nullptr;
+        uint32_t tick = 0;       // Absolute tick of the next event
+        uint8_t runningStatus = 0;
+    };
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    int division_ = 480;         // Ticks per quarter note
+    std::vector<Track> tracks_;
+    std::vector<int> heap_;      // Track indices ordered by next tick
+
+    // Tempo map state, advanced as events are merged in tick order
+    uint32_t endTick_ = 0;
+    uint32_t tempoTick_ = 0;
+    double tempoTime_ = 0.0;
+    double msPerTick_ = 0.0;
+
+    MidiEvent pending_;
+    bool hasPending_ = false;
+
+    bool readDelta(Track& t);
+    bool readEvent(Track& t, MidiEvent& ev);
+    double tickToMs(uint32_t tick) const;
+    bool laterThan(int a, int b) const;
+};
+
+#endif // MIDI_STREAM_H
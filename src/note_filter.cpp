@@ -0,0 +1,78 @@
+#include "note_filter.h"
+#include <algorithm>
+
+void NoteFilter::configure(const Config& config, int sampleRate) {
+    config_ = config;
+    enabled_ = config.enabled();
+    // Assigning fresh vectors also frees the tables when disabled
+    channels_ = enabled_ ? std::min(std::max(config.channels, 0), CHANNELS) : 0;
+    lastNoteOn_ = std::vector<uint64_t>(channels_ * KEYS);
+    swallowOff_ = std::vector<uint16_t>(channels_ * KEYS);
+    overloadNotes_ = config.maxNotesPerBlock > 0 ? config.maxNotesPerBlock / 2 : DEFAULT_OVERLOAD_NOTES;
+    setSampleRate(sampleRate);
+}
+
+void NoteFilter::setSampleRate(int sampleRate) {
+    windowFrames_ = static_cast<uint64_t>(config_.coalesceMs * sampleRate / 1000.0);
+}
+
+bool NoteFilter::acceptNoteOn(int channel, int key, int velocity) {
+    if (channel < 0 || channel >= channels_ || key < 0 || key >= KEYS) {
+        return true;
+    }
+    int slot = channel * KEYS + key;
+
+    // Same key retriggered within the window: keep the sounding voice
+    uint64_t last = lastNoteOn_[slot];
+    if (config_.coalesceMs > 0.0 && last && frame_ - (last - 1) <= windowFrames_) {
+        ++swallowOff_[slot];
+        merged_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (config_.maxNotesPerBlock > 0 && blockNotes_ >= config_.maxNotesPerBlock) {
+        ++swallowOff_[slot];
+        overCap_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (velocity < config_.velocityFloor && blockNotes_ >= overloadNotes_) {
+        ++swallowOff_[slot];
+        belowFloor_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    lastNoteOn_[slot] = frame_ + 1;
+    ++blockNotes_;
+    return true;
+}
+
+bool NoteFilter::acceptNoteOff(int channel, int key) {
+    if (channel < 0 || channel >= channels_ || key < 0 || key >= KEYS) {
+        return true;
+    }
+    int slot = channel * KEYS + key;
+
+    if (swallowOff_[slot] > 0) {
+        --swallowOff_[slot];
+        return false;
+    }
+    return true;
+}
+
+void NoteFilter::advance(int frames) {
+    frame_ += frames;
+    blockNotes_ = 0;
+}
+
+void NoteFilter::reset() {
+    std::fill(swallowOff_.begin(), swallowOff_.end(), 0);
+}
+
+NoteFilter::Stats NoteFilter::getStats() const {
+    Stats stats;
+    stats.merged = merged_.load(std::memory_order_relaxed);
+    stats.belowFloor = belowFloor_.load(std::memory_order_relaxed);
+    stats.overCap = overCap_.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,75 @@
+#ifndef NOTE_FILTER_H
+#define NOTE_FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Optional note-on thinning for very dense input (e.g. "black MIDI").
+// Applied by Synthesizer under its lock, so it covers file playback and all
+// live input paths alike.
+class NoteFilter {
+public:
+    struct Config {
+        double coalesceMs = 0.0;    // Merge same channel/key note-ons closer than this
+        int velocityFloor = 0;      // Under overload, drop note-ons below this velocity
+        int maxNotesPerBlock = 0;   // Cap note-ons per render block (0 = unlimited)
+        int channels = 16;          // Channels the inputs can address, up to CHANNELS;
+                                    // higher ones pass unfiltered
+
+        bool enabled() const {
+            return coalesceMs > 0.0 || velocityFloor > 0 || maxNotesPerBlock > 0;
+        }
+    };
+
+    struct Stats {
+        uint64_t merged = 0;        // Duplicate note-ons folded into a sounding note
+        uint64_t belowFloor = 0;    // Dropped by the velocity floor
+        uint64_t overCap = 0;       // Dropped by the per-block cap
+    };
+
+    static constexpr int CHANNELS = 256;   // Full MidiEvent channel range (16 ALSA ports)
+    static constexpr int KEYS = 128;
+
+    // Without a cap, the velocity floor kicks in after this many note-ons in a block
+    static constexpr int DEFAULT_OVERLOAD_NOTES = 32;
+
+    void configure(const Config& config, int sampleRate);
+    void setSampleRate(int sampleRate);
+    bool enabled() const { return enabled_; }
+
+    // Returns false if the note-on should be dropped
+    bool acceptNoteOn(int channel, int key, int velocity);
+
+    // Returns false if the note-off belongs to a dropped or merged note-on
+    bool acceptNoteOff(int channel, int key);
+
+    // Advance the sample clock after a block has been rendered
+    void advance(int frames);
+
+    // Forget pending note-off bookkeeping (all notes off)
+    void reset();
+
+    Stats getStats() const;
+
+private:
+    Config config_;
+    bool enabled_ = false;
+    uint64_t windowFrames_ = 0;
+    int overloadNotes_ = DEFAULT_OVERLOAD_NOTES;
+
+    uint64_t frame_ = 0;        // Sample position of the current block
+    int blockNotes_ = 0;        // Note-ons accepted in the current block
+
+    // Per channel * KEYS + key, allocated by configure() only while enabled
+    // and only for the configured channels
+    int channels_ = 0;
+    std::vector<uint64_t> lastNoteOn_;   // Frame of the last accepted note-on + 1 (0 = never)
+    std::vector<uint16_t> swallowOff_;   // Note-offs to swallow for dropped/merged note-ons
+
+    std::atomic<uint64_t> merged_{0};
+    std::atomic<uint64_t> belowFloor_{0};
+    std::atomic<uint64_t> overCap_{0};
+};
+
+#endif // NOTE_FILTER_H
@@ -0,0 +1,333 @@
+#include "osc_input.h"
+#include "synth.h"
+#include "trace.h"
+#include "thread_policy.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+
+// Seconds between the NTP epoch (1900) used by OSC timetags and 1970
+constexpr double NTP_UNIX_OFFSET = 2208988800.0;
+
+// Timetag 1 means "immediately"
+constexpr uint64_t TIMETAG_IMMEDIATE = 1;
+
+constexpr int MAX_BUNDLE_DEPTH = 8;
+constexpr int MAX_ARGS = 4;
+
+double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+double timetagToMs(uint64_t timetag) {
+    double seconds = static_cast<double>(timetag >> 32) - NTP_UNIX_OFFSET;
+    double fraction = static_cast<double>(timetag & 0xFFFFFFFFu) / 4294967296.0;
+    return (seconds + fraction) * 1000.0;
+}
+
+uint32_t readU32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+// Read a null-terminated, 4-byte padded OSC string; advances pos
+bool readString(const uint8_t*& pos, const uint8_t* end, const char*& str, size_t& length) {
+    const uint8_t* nul = static_cast<const uint8_t*>(std::memchr(pos, 0, end - pos));
+    if (!nul) {
+        return false;
+    }
+    str = reinterpret_cast<const char*>(pos);
+    length = nul - pos;
+    size_t padded = (length + 4) & ~size_t(3);
+    if (padded > size_t(end - pos)) {
+        return false;
+    }
+    pos += padded;
+    return true;
+}
+
+bool addressIs(const char* address, size_t length, const char* name) {
+    return std::strlen(name) == length && std::memcmp(address, name, length) == 0;
+}
+
+} // namespace
+
+OscInput::OscInput(Synthesizer& synth)
+    : synth_(synth) {
+}
+
+OscInput::~OscInput() {
+    stop();
+}
+
+bool OscInput::start(int port, const char* bindAddress) {
+    if (running_.load()) {
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, bindAddress, &addr.sin_addr) != 1) {
+        std::fprintf(stderr, "Invalid OSC bind address: %s\n", bindAddress);
+        return false;
+    }
+
+    socketFd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd_ < 0) {
+        std::fprintf(stderr, "Failed to create OSC socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (bind(socketFd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::fprintf(stderr, "Failed to bind OSC port %s:%d: %s\n", bindAddress, port, strerror(errno));
+        cleanup();
+        return false;
+    }
+
+    socklen_t addrLen = sizeof(addr);
+    getsockname(socketFd_, (struct sockaddr*)&addr, &addrLen);
+    port_ = ntohs(addr.sin_port);
+    address_ = bindAddress;
+
+    if (pipe(wakeFds_) < 0) {
+        std::fprintf(stderr, "Failed to create wake pipe: %s\n", strerror(errno));
+        cleanup();
+        return false;
+    }
+    for (int fd : {socketFd_, wakeFds_[0], wakeFds_[1]}) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    packets_.resize(MAX_DATAGRAMS * MAX_PACKET);
+    batch_.resize(MAX_EVENTS);
+    batchCount_ = 0;
+
+    running_.store(true);
+    inputThread_ = std::thread(&OscInput::inputLoop, this);
+
+    std::printf("Listening for OSC on UDP %s:%d\n", address_.c_str(), port_);
+    return true;
+}
+
+void OscInput::stop() {
+    running_.store(false);
+
+    if (wakeFds_[1] >= 0) {
+        char c = 0;
+        (void)!write(wakeFds_[1], &c, 1);
+    }
+
+    if (inputThread_.joinable()) {
+        inputThread_.join();
+    }
+
+    cleanup();
+}
+
+void OscInput::cleanup() {
+    for (int* fd : {&socketFd_, &wakeFds_[0], &wakeFds_[1]}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void OscInput::inputLoop() {
+    struct mmsghdr msgs[MAX_DATAGRAMS];
+    struct iovec iovs[MAX_DATAGRAMS];
+    for (int i = 0; i < MAX_DATAGRAMS; ++i) {
+        iovs[i].iov_base = packets_.data() + i * MAX_PACKET;
+        iovs[i].iov_len = MAX_PACKET;
+        std::memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    Trace::registerThread("osc-input");
+    ThreadPolicy::apply(ThreadPolicy::Role::Input, "osc-input");
+
+    while (running_.load()) {
+        struct pollfd pfds[2];
+        pfds[0] = {wakeFds_[0], POLLIN, 0};
+        pfds[1] = {socketFd_, POLLIN, 0};
+
+        int ret = poll(pfds, 2, -1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfds[0].revents) {
+            break;  // stop() requested
+        }
+
+        TraceSpan span("osc.receive");
+
+        // Map the system clock onto the render clock once per pass. Like
+        // ALSA queue events, timetagged events land one render block after
+        // their time, which keeps their spacing sample-accurate.
+        Synthesizer::Clock clock = synth_.getClock();
+        int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        nowMs_ = nowMs();
+        baseFrame_ = clock.frame + (nowNs - clock.timeNs) * 1e-9 * clock.sampleRate + clock.blockFrames;
+        sampleRate_ = clock.sampleRate;
+
+        if (pfds[1].revents & POLLIN) {
+            int count = recvmmsg(socketFd_, msgs, MAX_DATAGRAMS, MSG_DONTWAIT, nullptr);
+            span.setCount(count);
+            for (int i = 0; i < count; ++i) {
+                // Truncated datagrams are dropped rather than half-decoded
+                if (!(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                    decodePacket(static_cast<const uint8_t*>(iovs[i].iov_base),
+                                 msgs[i].msg_len, TIMETAG_IMMEDIATE, 0);
+                }
+            }
+        }
+
+        flush();
+    }
+
+    running_.store(false);
+}
+
+void OscInput::decodePacket(const uint8_t* data, size_t size, uint64_t timetag, int depth) {
+    if (size < 8 || (size & 3) != 0) {
+        return;
+    }
+
+    if (std::memcmp(data, "#bundle", 8) != 0) {
+        decodeMessage(data, size, timetag);
+        return;
+    }
+
+    // #bundle, 64-bit timetag, then (int32 size, element) pairs
+    if (size < 16 || depth >= MAX_BUNDLE_DEPTH) {
+        return;
+    }
+    uint64_t bundleTag = (uint64_t(readU32(data + 8)) << 32) | readU32(data + 12);
+
+    const uint8_t* pos = data + 16;
+    const uint8_t* end = data + size;
+    while (end - pos >= 4) {
+        uint32_t elementSize = readU32(pos);
+        pos += 4;
+        if (elementSize > size_t(end - pos)) {
+            return;
+        }
+        decodePacket(pos, elementSize, bundleTag, depth + 1);
+        pos += elementSize;
+    }
+}
+
+void OscInput::decodeMessage(const uint8_t* data, size_t size, uint64_t timetag) {
+    const uint8_t* pos = data;
+    const uint8_t* end = data + size;
+
+    const char* address;
+    const char* tags;
+    size_t addressLen, tagCount;
+    if (!readString(pos, end, address, addressLen) ||
+        !readString(pos, end, tags, tagCount) || tagCount == 0 || tags[0] != ',') {
+        return;
+    }
+
+    // Arguments: int32 or float32, converted to integers
+    int args[MAX_ARGS];
+    int argCount = 0;
+    for (size_t i = 1; i < tagCount; ++i) {
+        if (argCount == MAX_ARGS || end - pos < 4) {
+            return;
+        }
+        uint32_t raw = readU32(pos);
+        pos += 4;
+        if (tags[i] == 'i') {
+            args[argCount++] = static_cast<int32_t>(raw);
+        } else if (tags[i] == 'f') {
+            float f;
+            std::memcpy(&f, &raw, sizeof(f));
+            args[argCount++] = static_cast<int>(std::lround(f));
+        } else {
+            return;  // Unsupported argument type
+        }
+    }
+
+    MidiEvent ev;
+    ev.time = 0.0;
+    ev.param2 = 0;
+
+    if (addressIs(address, addressLen, "/noteon") && argCount == 3) {
+        ev.type = MIDI_NOTE_ON;
+    } else if (addressIs(address, addressLen, "/noteoff") && argCount == 2) {
+        ev.type = MIDI_NOTE_OFF;
+    } else if (addressIs(address, addressLen, "/cc") && argCount == 3) {
+        ev.type = MIDI_CONTROL_CHANGE;
+    } else if (addressIs(address, addressLen, "/pc") && argCount == 2) {
+        ev.type = MIDI_PROGRAM_CHANGE;
+    } else if (addressIs(address, addressLen, "/pitch") && argCount == 2) {
+        ev.type = MIDI_PITCH_BEND;
+    } else {
+        return;
+    }
+
+    if (args[0] < 0 || args[0] > 255) {
+        return;
+    }
+    ev.channel = args[0];
+
+    if (ev.type == MIDI_PITCH_BEND) {
+        if (args[1] < 0 || args[1] > 16383) {
+            return;
+        }
+        ev.param1 = args[1] & 0x7F;
+        ev.param2 = args[1] >> 7;
+    } else {
+        for (int i = 1; i < argCount; ++i) {
+            if (args[i] < 0 || args[i] > 127) {
+                return;
+            }
+        }
+        ev.param1 = args[1];
+        if (argCount > 2) {
+            ev.param2 = args[2];
+        }
+    }
+
+    push(ev, timetag);
+}
+
+void OscInput::push(const MidiEvent& ev, uint64_t timetag) {
+    if (batchCount_ == MAX_EVENTS) {
+        flush();
+    }
+    // Immediate (time 0) and past events play at the next block
+    MidiEvent& queued = batch_[batchCount_++];
+    queued = ev;
+    if (timetag != TIMETAG_IMMEDIATE) {
+        queued.time = baseFrame_ + (timetagToMs(timetag) - nowMs_) * 0.001 * sampleRate_;
+    }
+}
+
+void OscInput::flush() {
+    if (batchCount_ > 0) {
+        Trace::instant("osc.events", batchCount_);
+        synth_.scheduleEvents(batch_.data(), batchCount_);
+        synth_.stats().countEvents(RuntimeStats::Source::Osc, batchCount_);
+        batchCount_ = 0;
+    }
+}
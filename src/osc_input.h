@@ -0,0 +1,69 @@
+#ifndef OSC_INPUT_H
+#define OSC_INPUT_H
+
+#include "midi_event.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class Synthesizer;
+
+// OSC 1.0 over UDP.
+// Addresses: /noteon ch note vel, /noteoff ch note, /cc ch ctrl val,
+// /pc ch prog, /pitch ch val. Arguments may be int32 or float32.
+// Bundles are unpacked; timetagged elements are scheduled on the synth's
+// render clock, as the ALSA queue path does.
+class OscInput {
+public:
+    OscInput(Synthesizer& synth);
+    ~OscInput();
+
+    // Listen for OSC packets on a UDP port (port 0 picks a free one) of an
+    // IPv4 address; 0.0.0.0 accepts packets from other hosts
+    bool start(int port, const char* bindAddress = DEFAULT_BIND_ADDRESS);
+
+    // Stop input handling
+    void stop();
+
+    // Check if running
+    bool isRunning() const { return running_.load(); }
+
+    // Port actually bound by start()
+    int getPort() const { return port_; }
+
+    static constexpr const char* DEFAULT_BIND_ADDRESS = "127.0.0.1";
+    static constexpr int MAX_DATAGRAMS = 32;     // Datagrams per recvmmsg()
+    static constexpr int MAX_PACKET = 2048;      // Largest datagram accepted
+    static constexpr int MAX_EVENTS = 512;       // Events applied per batch
+
+private:
+    Synthesizer& synth_;
+    std::atomic<bool> running_{false};
+    std::thread inputThread_;
+    int socketFd_ = -1;
+    int port_ = 0;
+    std::string address_;
+    int wakeFds_[2] = {-1, -1};
+
+    // Receive buffers and event batch, sized once in start()
+    std::vector<uint8_t> packets_;
+    std::vector<MidiEvent> batch_;
+    int batchCount_ = 0;
+
+    // Timetag to render frame mapping, taken once per pass
+    double nowMs_ = 0.0;       // CLOCK_REALTIME in milliseconds
+    double baseFrame_ = 0.0;   // Render frame matching nowMs_, one block ahead
+    int sampleRate_ = 0;
+
+    void inputLoop();
+    void decodePacket(const uint8_t* data, size_t size, uint64_t timetag, int depth);
+    void decodeMessage(const uint8_t* data, size_t size, uint64_t timetag);
+    void push(const MidiEvent& ev, uint64_t timetag);
+    void flush();
+    void cleanup();
+};
+
+#endif // OSC_INPUT_H
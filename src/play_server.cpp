@@ -0,0 +1,517 @@
+#include "play_server.h"
+#include "audio.h"
+#include "midi_file.h"
+#include "synth.h"
+#include "trace.h"
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// One connected 'play' process and the playback it asked for
+struct PlayServer::Client {
+    int fd = -1;                        // -1 once the connection is gone
+    std::string request;                // Request text not yet parsed
+    bool complete = false;              // 'play' line received
+    double speed = 1.0;
+    bool releaseTail = false;
+    std::vector<std::string> files;
+    std::unique_ptr<Synthesizer> synth;  // The hand-off's own channels and voices
+    std::unique_ptr<MidiPlayer> player;
+    int slot = -1;
+    size_t nextFile = 1;                // Next file to queue behind the current one
+    std::vector<size_t> queuedFiles;    // Song index -> file
+    int announced = -1;                 // Song index last reported to the client
+    bool closing = false;               // Cancelled, waiting for the audio thread
+};
+
+namespace {
+
+// Used from the server thread; a client that stopped reading loses replies
+void sendLine(int fd, const std::string& text) {
+    if (fd < 0) {
+        return;
+    }
+    std::string line = text + "\n";
+    (void)!send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+}
+
+bool fillAddress(const std::string& path, struct sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+// Connected stream socket to path, or -1
+int connectTo(const std::string& path) {
+    struct sockaddr_un addr;
+    if (!fillAddress(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// Open and page in a MIDI file (server thread, never the audio thread)
+std::unique_ptr<MidiStream> openStream(const std::string& path) {
+    auto stream = std::make_unique<MidiStream>();
+    if (!stream->open(path)) {
+        return nullptr;
+    }
+    stream->prefetch();
+    return stream;
+}
+
+} // namespace
+
+PlayServer::PlayServer(Synthesizer& synth)
+    : synth_(synth) {
+}
+
+PlayServer::~PlayServer() {
+    stop();
+}
+
+std::string PlayServer::defaultPath() {
+    const char* tmp = std::getenv("TMPDIR");
+    return std::string(tmp && *tmp ? tmp : "/tmp") + "/termux-midi-play.sock";
+}
+
+bool PlayServer::start(const std::string& path) {
+    if (running_.load()) {
+        return false;
+    }
+
+    // A socket file left by a crashed daemon is replaced, a live one is not
+    int probe = connectTo(path);
+    if (probe >= 0) {
+        close(probe);
+        std::fprintf(stderr, "Another daemon is taking 'play' hand-offs on %s\n", path.c_str());
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    if (!fillAddress(path, addr)) {
+        std::fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return false;
+    }
+
+    socketFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFd_ < 0) {
+        std::fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+    fcntl(socketFd_, F_SETFD, FD_CLOEXEC);
+
+    unlink(path.c_str());
+    if (bind(socketFd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(socketFd_, MAX_PLAYERS) < 0) {
+        std::fprintf(stderr, "Failed to listen on %s: %s\n", path.c_str(), strerror(errno));
+        cleanup();
+        return false;
+    }
+    socketPath_ = path;
+    fcntl(socketFd_, F_SETFL, fcntl(socketFd_, F_GETFL, 0) | O_NONBLOCK);
+
+    if (pipe(wakeFds_) < 0) {
+        std::fprintf(stderr, "Failed to create wake pipe: %s\n", strerror(errno));
+        cleanup();
+        return false;
+    }
+    for (int fd : wakeFds_) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    running_.store(true);
+    thread_ = std::thread(&PlayServer::serverLoop, this);
+
+    std::printf("Accepting 'play' hand-offs on: %s\n", path.c_str());
+    return true;
+}
+
+void PlayServer::stop() {
+    running_.store(false);
+
+    if (wakeFds_[1] >= 0) {
+        char c = 0;
+        (void)!write(wakeFds_[1], &c, 1);
+    }
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    cleanup();
+}
+
+void PlayServer::cleanup() {
+    if (socketFd_ >= 0) {
+        close(socketFd_);
+        socketFd_ = -1;
+    }
+
+    if (!socketPath_.empty()) {
+        unlink(socketPath_.c_str());
+        socketPath_.clear();
+    }
+
+    for (int& fd : wakeFds_) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+void PlayServer::process(int16_t* buffer, int frames) {
+    for (Slot& slot : slots_) {
+        MidiPlayer* player = slot.active.load(std::memory_order_acquire);
+        if (!player) {
+            continue;
+        }
+        if (slot.cancel.load(std::memory_order_acquire)) {
+            // Release everything, pedal included, and let it ring out before
+            // handing the player back
+            if (slot.releaseFrames < 0) {
+                player->stop();
+                slot.releaseFrames = 0;
+            }
+            int maxFrames = static_cast<int>(MAX_RELEASE_SECONDS * slot.synth->getSampleRate());
+            if (slot.synth->getActiveVoiceCount() == 0 || slot.releaseFrames >= maxFrames) {
+                slot.active.store(nullptr, std::memory_order_release);
+                continue;
+            }
+            slot.releaseFrames += frames;
+        } else {
+            player->process(frames);
+        }
+        slot.synth->render(buffer, frames, true);
+    }
+}
+
+void PlayServer::serverLoop() {
+    std::vector<Client> clients;
+    std::vector<struct pollfd> pfds;
+    bool taken[MAX_PLAYERS] = {};
+    Trace::registerThread("play-server");
+
+    while (running_.load()) {
+        // Slot 0 is the wake pipe, slot 1 the listening socket, then clients.
+        // Poll on a short timeout while anything plays, to follow its progress.
+        bool playing = false;
+        pfds.resize(2 + clients.size());
+        pfds[0] = {wakeFds_[0], POLLIN, 0};
+        pfds[1] = {socketFd_, POLLIN, 0};
+        for (size_t i = 0; i < clients.size(); ++i) {
+            pfds[2 + i] = {clients[i].fd, POLLIN, 0};   // Negative fds are skipped
+            playing = playing || clients[i].player;
+        }
+
+        int ret = poll(pfds.data(), pfds.size(), playing ? 50 : -1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfds[0].revents) {
+            break;  // stop() requested
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            Client& client = clients[i];
+            if (client.fd >= 0 && (pfds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                !readRequest(client)) {
+                close(client.fd);
+                client.fd = -1;
+                client.closing = true;
+            }
+
+            // Start once the request is complete, if a player slot is free
+            if (client.complete && !client.player && !client.closing) {
+                int slot = 0;
+                while (slot < MAX_PLAYERS && taken[slot]) {
+                    ++slot;
+                }
+                client.slot = slot;
+                if (slot == MAX_PLAYERS) {
+                    sendLine(client.fd, "busy");
+                    client.closing = true;
+                } else if (startPlayback(client)) {
+                    taken[slot] = true;
+                } else {
+                    client.closing = true;
+                }
+            }
+
+            if (client.player && !client.closing) {
+                advance(client);
+            }
+            if (client.player && client.closing) {
+                slots_[client.slot].cancel.store(true, std::memory_order_release);
+            }
+
+            // Gone once the audio thread has let go of its player
+            if (client.closing &&
+                (!client.player || !slots_[client.slot].active.load(std::memory_order_acquire))) {
+                if (client.player) {
+                    taken[client.slot] = false;
+                }
+                if (client.fd >= 0) {
+                    close(client.fd);
+                }
+                continue;
+            }
+
+            if (kept != i) {
+                clients[kept] = std::move(client);
+            }
+            ++kept;
+        }
+        clients.resize(kept);
+
+        if (pfds[1].revents & POLLIN) {
+            for (;;) {
+                int clientFd = accept(socketFd_, nullptr, nullptr);
+                if (clientFd < 0) {
+                    break;
+                }
+                fcntl(clientFd, F_SETFL, fcntl(clientFd, F_GETFL, 0) | O_NONBLOCK);
+                fcntl(clientFd, F_SETFD, FD_CLOEXEC);
+
+                Client client;
+                client.fd = clientFd;
+                clients.push_back(std::move(client));
+            }
+        }
+    }
+
+    // The audio output is stopped by now, so players can go directly
+    for (Client& client : clients) {
+        if (client.player) {
+            slots_[client.slot].active.store(nullptr, std::memory_order_release);
+        }
+        if (client.fd >= 0) {
+            close(client.fd);
+        }
+    }
+    running_.store(false);
+}
+
+bool PlayServer::readRequest(Client& client) {
+    char buffer[4096];
+    ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        return false;
+    }
+    if (n < 0 || client.complete) {
+        return true;   // Nothing more is read once the request is complete
+    }
+
+    client.request.append(buffer, n);
+    size_t start = 0;
+    size_t end;
+    while ((end = client.request.find('\n', start)) != std::string::npos) {
+        std::string line = client.request.substr(start, end - start);
+        start = end + 1;
+        if (line.compare(0, 6, "speed ") == 0) {
+            client.speed = std::atof(line.c_str() + 6);
+        } else if (line == "tail") {
+            client.releaseTail = true;
+        } else if (line.compare(0, 5, "file ") == 0) {
+            client.files.push_back(line.substr(5));
+        } else if (line == "play") {
+            if (client.files.empty()) {
+                sendLine(client.fd, "error no files given");
+                return false;
+            }
+            client.complete = true;
+            client.request.clear();
+            return true;
+        } else {
+            sendLine(client.fd, "error unknown request: " + line);
+            return false;
+        }
+    }
+    client.request.erase(0, start);
+
+    if (client.request.size() > MAX_REQUEST) {
+        sendLine(client.fd, "error request too long");
+        return false;
+    }
+    return true;
+}
+
+bool PlayServer::startPlayback(Client& client) {
+    auto synth = std::make_unique<Synthesizer>();
+    synth->setOutput(synth_.getSampleRate(), AudioOutput::CHANNELS);
+    if (!synth->shareSoundFont(synth_)) {
+        sendLine(client.fd, "error no soundfont");
+        return false;
+    }
+    auto player = std::make_unique<MidiPlayer>(*synth);
+    if (!player->load(client.files[0])) {
+        sendLine(client.fd, "error cannot open " + client.files[0]);
+        return false;
+    }
+    player->setStats(synth_.stats());
+    player->setSpeed(client.speed);
+    player->setReleaseTail(client.releaseTail);
+    player->play();
+
+    client.queuedFiles = {0};
+    client.announced = 0;
+    client.synth = std::move(synth);
+    client.player = std::move(player);
+    Slot& slot = slots_[client.slot];
+    slot.synth = client.synth.get();
+    slot.releaseFrames = -1;
+    slot.cancel.store(false, std::memory_order_relaxed);
+    slot.active.store(client.player.get(), std::memory_order_release);
+
+    std::printf("Playing for 'play' client: %s\n", client.files[0].c_str());
+    sendLine(client.fd, "playing " + client.files[0]);
+    return true;
+}
+
+void PlayServer::advance(Client& client) {
+    MidiPlayer& player = *client.player;
+    player.releaseRetired();
+
+    // Keep the next file queued so the player switches over gaplessly
+    while (client.nextFile < client.files.size() && !player.hasQueued()) {
+        const std::string& path = client.files[client.nextFile];
+        std::unique_ptr<MidiStream> stream = openStream(path);
+        if (stream) {
+            player.queue(std::move(stream));
+            client.queuedFiles.push_back(client.nextFile);
+            if (player.isFinished()) {
+                player.play();
+            }
+        } else {
+            sendLine(client.fd, "skipping " + path);
+        }
+        ++client.nextFile;
+    }
+
+    int current = player.songIndex();
+    if (current != client.announced && current < static_cast<int>(client.queuedFiles.size())) {
+        client.announced = current;
+        sendLine(client.fd, "playing " + client.files[client.queuedFiles[current]]);
+    }
+
+    if (player.isFinished() && !player.hasQueued() && client.nextFile >= client.files.size()) {
+        sendLine(client.fd, "done");
+        client.closing = true;
+    }
+}
+
+int playOnServer(const std::string& path, const std::vector<std::string>& files,
+                 double speed, bool releaseTail, const std::atomic<bool>& running) {
+    int fd = connectTo(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // The daemon has its own working directory, so send absolute paths
+    char line[64];
+    std::snprintf(line, sizeof(line), "speed %.17g\n", speed);
+    std::string request = line;
+    if (releaseTail) {
+        request += "tail\n";
+    }
+    for (const std::string& file : files) {
+        char resolved[PATH_MAX];
+        request += "file ";
+        request += realpath(file.c_str(), resolved) ? resolved : file;
+        request += "\n";
+    }
+    request += "play\n";
+
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += n;
+    }
+
+    // Follow the daemon's progress; closing the socket stops the playback
+    std::string pending;
+    int result = -1;
+    bool announced = false;
+    while (result == -1 && running.load()) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, 100);
+        if (ret < 0 && errno != EINTR) {
+            result = 1;
+            break;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+
+        char buffer[1024];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::fprintf(stderr, "Daemon closed the connection\n");
+            result = 1;
+            break;
+        }
+        pending.append(buffer, n);
+
+        size_t end;
+        while (result == -1 && (end = pending.find('\n')) != std::string::npos) {
+            std::string reply = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            if (reply.compare(0, 8, "playing ") == 0) {
+                if (!announced) {
+                    std::printf("Playing on the running daemon (%s)\n", path.c_str());
+                    announced = true;
+                }
+                std::printf("Now playing: %s\n", reply.c_str() + 8);
+            } else if (reply.compare(0, 9, "skipping ") == 0) {
+                std::fprintf(stderr, "Skipping %s\n", reply.c_str() + 9);
+            } else if (reply == "done") {
+                result = 0;
+            } else if (reply == "busy") {
+                close(fd);
+                return -1;   // All players taken: play locally instead
+            } else if (reply.compare(0, 6, "error ") == 0) {
+                std::fprintf(stderr, "Daemon: %s\n", reply.c_str() + 6);
+                result = 1;
+            }
+        }
+    }
+
+    close(fd);
+    if (result != 1) {
+        std::printf("Playback finished\n");
+    }
+    return result == 1 ? 1 : 0;
+}
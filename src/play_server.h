@@ -0,0 +1,81 @@
+#ifndef PLAY_SERVER_H
+#define PLAY_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Synthesizer;
+class MidiPlayer;
+
+// Lets 'play' reuse a running 'listen' or 'serve' process. MIDI files handed
+// over on a well-known Unix socket play on extra MidiPlayers driven by the
+// daemon's audio callback, so the soundfont and audio output are already up.
+// Each hand-off plays on its own synth sharing the daemon's soundfont, so its
+// programs, controllers and pedal never touch the live input's channels.
+//
+// One request per connection, as text lines:
+//   speed <factor>, tail, file <absolute path> (repeatable), play
+// Replies: "playing <path>" as each file starts, then "done", or
+// "error <reason>". Closing the connection stops that playback.
+class PlayServer {
+public:
+    PlayServer(Synthesizer& synth);
+    ~PlayServer();
+
+    // $TMPDIR/termux-midi-play.sock
+    static std::string defaultPath();
+
+    // Accept hand-offs on path. Fails, leaving the socket alone, when
+    // another daemon already answers there.
+    bool start(const std::string& path);
+
+    // Stop accepting and drop all handed-over players
+    // (call once the audio output has stopped)
+    void stop();
+
+    // Advance every handed-over player and mix its synth into buffer
+    // (call from the audio callback, after the daemon's synth has rendered)
+    void process(int16_t* buffer, int frames);
+
+    static constexpr int MAX_PLAYERS = 8;        // Hand-offs playing at once
+    static constexpr int MAX_REQUEST = 65536;    // Longest request accepted
+    static constexpr double MAX_RELEASE_SECONDS = 3.0;   // Ring-out after a hand-off ends
+
+private:
+    // The audio thread owns a player and its synth while active is set; the
+    // server thread sets cancel and frees them once the audio thread has let
+    // the notes ring out and cleared active.
+    struct Slot {
+        std::atomic<MidiPlayer*> active{nullptr};
+        std::atomic<bool> cancel{false};
+        Synthesizer* synth = nullptr;   // Set before active
+        int releaseFrames = -1;         // Audio thread: ring-out so far, -1 before cancel
+    };
+
+    struct Client;
+
+    Synthesizer& synth_;
+    Slot slots_[MAX_PLAYERS];
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+    int socketFd_ = -1;
+    std::string socketPath_;
+    int wakeFds_[2] = {-1, -1};
+
+    void serverLoop();
+    bool readRequest(Client& client);
+    bool startPlayback(Client& client);
+    void advance(Client& client);
+    void cleanup();
+};
+
+// Hand files to the daemon on path and wait while they play.
+// Returns -1 if no daemon answers there (play locally), else the exit code.
+int playOnServer(const std::string& path, const std::vector<std::string>& files,
+                 double speed, bool releaseTail, const std::atomic<bool>& running);
+
+#endif // PLAY_SERVER_H
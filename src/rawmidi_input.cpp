@@ -0,0 +1,160 @@
+#ifdef USE_ALSA
+
+#include "rawmidi_input.h"
+#include "midi_parser.h"
+#include "midi_event.h"
+#include "synth.h"
+#include "trace.h"
+#include "thread_policy.h"
+#include <alsa/asoundlib.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct RawMidiInput::Impl {
+    snd_rawmidi_t* in = nullptr;
+    int wakeFds[2] = {-1, -1};  // Self-pipe to interrupt poll() on stop()
+    MidiParser parser;
+};
+
+RawMidiInput::RawMidiInput(Synthesizer& synth)
+    : synth_(synth), impl_(new Impl) {
+}
+
+RawMidiInput::~RawMidiInput() {
+    stop();
+    delete impl_;
+}
+
+bool RawMidiInput::start(const std::string& device) {
+    if (running_.load()) {
+        return false;
+    }
+
+    int err = snd_rawmidi_open(&impl_->in, nullptr, device.c_str(), SND_RAWMIDI_NONBLOCK);
+    if (err < 0) {
+        std::fprintf(stderr, "Failed to open rawmidi device %s: %s\n", device.c_str(), snd_strerror(err));
+        impl_->in = nullptr;
+        return false;
+    }
+
+    if (pipe(impl_->wakeFds) < 0) {
+        std::fprintf(stderr, "Failed to create wake pipe: %s\n", strerror(errno));
+        snd_rawmidi_close(impl_->in);
+        impl_->in = nullptr;
+        return false;
+    }
+    for (int fd : impl_->wakeFds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    impl_->parser.reset();
+
+    std::printf("Reading raw MIDI from %s\n", device.c_str());
+
+    running_.store(true);
+    inputThread_ = std::thread(&RawMidiInput::inputLoop, this);
+    return true;
+}
+
+void RawMidiInput::stop() {
+    running_.store(false);
+
+    // Wake the input thread out of poll()
+    if (impl_->wakeFds[1] >= 0) {
+        char c = 0;
+        (void)!write(impl_->wakeFds[1], &c, 1);
+    }
+
+    if (inputThread_.joinable()) {
+        inputThread_.join();
+    }
+
+    if (impl_->in) {
+        snd_rawmidi_close(impl_->in);
+        impl_->in = nullptr;
+    }
+
+    for (int& fd : impl_->wakeFds) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+void RawMidiInput::inputLoop() {
+    // Wake pipe first, then the device's own descriptors
+    int devCount = snd_rawmidi_poll_descriptors_count(impl_->in);
+    std::vector<struct pollfd> pfds(1 + devCount);
+    pfds[0] = {impl_->wakeFds[0], POLLIN, 0};
+    snd_rawmidi_poll_descriptors(impl_->in, &pfds[1], devCount);
+
+    uint8_t buffer[READ_SIZE];
+    MidiEvent events[READ_SIZE];
+    Trace::registerThread("rawmidi-input");
+    ThreadPolicy::apply(ThreadPolicy::Role::Input, "rawmidi-input");
+
+    while (running_.load()) {
+        int ret = poll(pfds.data(), pfds.size(), -1);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfds[0].revents) {
+            break;  // stop() requested
+        }
+
+        // Read until the device is empty; each read is applied as one batch
+        TraceSpan span("rawmidi.receive");
+        bool failed = false;
+        for (;;) {
+            long n = snd_rawmidi_read(impl_->in, buffer, sizeof(buffer));
+            if (n == -EAGAIN || n == 0) {
+                break;
+            }
+            if (n < 0) {
+                std::fprintf(stderr, "rawmidi read failed: %s\n", snd_strerror(static_cast<int>(n)));
+                failed = true;
+                break;
+            }
+
+            int count = impl_->parser.decode(buffer, static_cast<size_t>(n), events);
+            if (count > 0) {
+                Trace::instant("rawmidi.events", count);
+                synth_.applyEvents(events, count);
+                synth_.stats().countEvents(RuntimeStats::Source::RawMidi, count);
+            }
+        }
+        if (failed) {
+            break;  // Device unplugged
+        }
+    }
+
+    running_.store(false);
+}
+
+#else // !USE_ALSA
+
+// Stub implementation when ALSA is not available
+#include "rawmidi_input.h"
+#include <cstdio>
+
+struct RawMidiInput::Impl {};
+
+RawMidiInput::RawMidiInput(Synthesizer& synth) : synth_(synth), impl_(nullptr) {}
+RawMidiInput::~RawMidiInput() {}
+
+bool RawMidiInput::start(const std::string&) {
+    std::fprintf(stderr, "ALSA support not compiled in\n");
+    return false;
+}
+
+void RawMidiInput::stop() {}
+
+#endif // USE_ALSA
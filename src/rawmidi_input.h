@@ -0,0 +1,41 @@
+#ifndef RAWMIDI_INPUT_H
+#define RAWMIDI_INPUT_H
+
+#include <string>
+#include <atomic>
+#include <thread>
+
+class Synthesizer;
+
+// Direct ALSA rawmidi input (e.g. a USB keyboard at hw:1,0,0).
+// Bytes are read straight from the device and decoded by MidiParser,
+// skipping the sequencer's routing and event translation.
+class RawMidiInput {
+public:
+    RawMidiInput(Synthesizer& synth);
+    ~RawMidiInput();
+
+    // Open a rawmidi device such as "hw:1,0" for input
+    bool start(const std::string& device);
+
+    // Stop input handling
+    void stop();
+
+    // Check if running
+    bool isRunning() const { return running_.load(); }
+
+    // Bytes read from the device per snd_rawmidi_read() call
+    static constexpr int READ_SIZE = 1024;
+
+private:
+    Synthesizer& synth_;
+    std::atomic<bool> running_{false};
+    std::thread inputThread_;
+
+    struct Impl;
+    Impl* impl_ = nullptr;
+
+    void inputLoop();
+};
+
+#endif // RAWMIDI_INPUT_H
@@ -0,0 +1,274 @@
+#include "render.h"
+#include "audio.h"
+#include "synth.h"
+#include "midi_file.h"
+#include "midi_stream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int BLOCK_FRAMES = AudioOutput::BUFFER_FRAMES;
+constexpr int WRITE_FRAMES = 16384;         // Frames buffered per fwrite
+constexpr double MAX_TAIL_SECONDS = 10.0;   // Release tail after the last event
+
+// Same conversion and clipping as tsf_render_short, so a mixed render and
+// the stems agree sample for sample where nothing clips
+int16_t toPcm(float v) {
+    return v < -1.00004566f ? -32768 : (v > 1.00001514f ? 32767 : static_cast<int16_t>(v * 32767.5f));
+}
+
+// 16-bit WAV file filled in large buffered writes; the header is patched
+// with the final length on close
+class WavWriter {
+public:
+    ~WavWriter() { close(); }
+
+    bool open(const std::string& path, int channels, int sampleRate) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            std::fprintf(stderr, "Failed to open WAV file: %s\n", path.c_str());
+            return false;
+        }
+        path_ = path;
+        channels_ = channels;
+        sampleRate_ = sampleRate;
+        frames_ = 0;
+        buffer_.resize(static_cast<size_t>(WRITE_FRAMES) * channels);
+        used_ = 0;
+        writeWavHeader(file_, 0, channels_, sampleRate_);
+        return true;
+    }
+
+    // Would frames more take the data past the 4 GiB a WAV header can hold?
+    bool full(int frames) const {
+        uint64_t bytes = (static_cast<uint64_t>(frames_) + frames) * channels_ * sizeof(int16_t);
+        return bytes > MAX_DATA_BYTES;
+    }
+
+    // Space for frames (at most WRITE_FRAMES) of interleaved samples,
+    // valid until the next call
+    int16_t* append(int frames) {
+        if (used_ + frames > WRITE_FRAMES) {
+            flush();
+        }
+        int16_t* out = buffer_.data() + static_cast<size_t>(used_) * channels_;
+        used_ += frames;
+        frames_ += frames;
+        return out;
+    }
+
+    bool close() {
+        if (!file_) {
+            return true;
+        }
+        flush();
+        std::fseek(file_, 0, SEEK_SET);
+        writeWavHeader(file_, frames_, channels_, sampleRate_);
+        bool ok = !failed_ && !std::ferror(file_);
+        ok = std::fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        if (!ok) {
+            std::fprintf(stderr, "Failed to write WAV file: %s\n", path_.c_str());
+        }
+        return ok;
+    }
+
+private:
+    static constexpr uint64_t MAX_DATA_BYTES = 0xFFFFFFFFull - 68;   // RIFF size field minus header
+
+    FILE* file_ = nullptr;
+    std::string path_;
+    int channels_ = 0;
+    int sampleRate_ = 0;
+    uint32_t frames_ = 0;
+    std::vector<int16_t> buffer_;
+    int used_ = 0;   // Frames waiting in buffer_
+    bool failed_ = false;
+
+    void flush() {
+        size_t samples = static_cast<size_t>(used_) * channels_;
+        if (samples > 0 && std::fwrite(buffer_.data(), sizeof(int16_t), samples, file_) != samples) {
+            failed_ = true;
+        }
+        used_ = 0;
+    }
+};
+
+// Channels that start notes anywhere in the file. Only the MIDI is parsed,
+// so this costs little next to the synthesis pass.
+bool scanChannels(const std::string& path, bool channels[Synthesizer::STEM_CHANNELS]) {
+    MidiStream stream;
+    if (!stream.open(path)) {
+        return false;
+    }
+    while (const MidiEvent* ev = stream.peek()) {
+        if (ev->type == MIDI_NOTE_ON && ev->param2 > 0) {
+            channels[ev->channel % Synthesizer::STEM_CHANNELS] = true;
+        }
+        stream.pop();
+    }
+    return true;
+}
+
+// song.wav -> song.ch10.wav
+std::string stemPath(const std::string& outPath, int channel) {
+    std::string base = outPath;
+    if (base.size() > 4 && base.compare(base.size() - 4, 4, ".wav") == 0) {
+        base.erase(base.size() - 4);
+    }
+    char suffix[24];
+    std::snprintf(suffix, sizeof(suffix), ".ch%02d.wav", channel + 1);
+    return base + suffix;
+}
+
+std::string defaultOutPath(const std::string& midiPath) {
+    std::string out = midiPath;
+    size_t slash = out.rfind('/');
+    size_t dot = out.rfind('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        out.erase(dot);
+    }
+    return out + ".wav";
+}
+
+} // namespace
+
+int runRender(const RenderOptions& options, const std::atomic<bool>& running) {
+    const bool stems = options.stems != RenderOptions::Stems::None;
+    std::string outPath = options.outPath.empty() ? defaultOutPath(options.midiPath) : options.outPath;
+
+    bool used[Synthesizer::STEM_CHANNELS] = {};
+    std::vector<int> channels;   // Channels that get a stem, in order
+    if (stems) {
+        if (!scanChannels(options.midiPath, used)) {
+            return 1;
+        }
+        for (int c = 0; c < Synthesizer::STEM_CHANNELS; ++c) {
+            if (used[c]) {
+                channels.push_back(c);
+            }
+        }
+        if (channels.empty()) {
+            std::fprintf(stderr, "No notes in %s\n", options.midiPath.c_str());
+            return 1;
+        }
+    }
+
+    Synthesizer synth;
+    std::printf("Loading soundfont: %s\n", options.sf2Path.c_str());
+    if (!synth.loadSoundFont(options.sf2Path)) {
+        return 1;
+    }
+    const int sampleRate = options.sampleRate;
+    synth.setOutput(sampleRate, AudioOutput::CHANNELS);
+
+    MidiPlayer player(synth);
+    std::printf("Loading MIDI file: %s\n", options.midiPath.c_str());
+    if (!player.load(options.midiPath)) {
+        return 1;
+    }
+    player.setSpeed(options.speed);
+
+    // One writer for the mix or the interleaved stems, else one per stem
+    std::vector<std::unique_ptr<WavWriter>> writers;
+    if (options.stems == RenderOptions::Stems::Files) {
+        for (int c : channels) {
+            writers.push_back(std::make_unique<WavWriter>());
+            if (!writers.back()->open(stemPath(outPath, c), AudioOutput::CHANNELS, sampleRate)) {
+                return 1;
+            }
+            std::printf("Channel %d -> %s\n", c + 1, stemPath(outPath, c).c_str());
+        }
+    } else {
+        int fileChannels = AudioOutput::CHANNELS * (stems ? static_cast<int>(channels.size()) : 1);
+        writers.push_back(std::make_unique<WavWriter>());
+        if (!writers.back()->open(outPath, fileChannels, sampleRate)) {
+            return 1;
+        }
+        if (stems) {
+            for (size_t i = 0; i < channels.size(); ++i) {
+                std::printf("Channel %d -> %s, tracks %zu-%zu\n", channels[i] + 1, outPath.c_str(),
+                            2 * i + 1, 2 * i + 2);
+            }
+        } else {
+            std::printf("Writing: %s\n", outPath.c_str());
+        }
+    }
+
+    std::vector<int16_t> mix(BLOCK_FRAMES * AudioOutput::CHANNELS);
+    std::vector<float> busData(stems ? Synthesizer::STEM_CHANNELS * BLOCK_FRAMES * 2 : 0);
+    float* buses[Synthesizer::STEM_CHANNELS];
+    for (int c = 0; c < Synthesizer::STEM_CHANNELS; ++c) {
+        buses[c] = stems ? busData.data() + c * BLOCK_FRAMES * 2 : nullptr;
+    }
+
+    std::printf("Rendering...\n");
+    auto start = std::chrono::steady_clock::now();
+    const long long maxTail = static_cast<long long>(MAX_TAIL_SECONDS * sampleRate);
+    long long frames = 0;
+    long long tail = 0;
+    bool truncated = false;
+    player.play();
+    while (running.load() && tail < maxTail) {
+        if (writers[0]->full(BLOCK_FRAMES)) {
+            std::fprintf(stderr, "Stopping at the 4 GiB WAV size limit\n");
+            truncated = true;
+            break;
+        }
+        player.process(BLOCK_FRAMES);
+
+        if (!stems) {
+            synth.render(mix.data(), BLOCK_FRAMES);
+            std::copy(mix.begin(), mix.end(), writers[0]->append(BLOCK_FRAMES));
+        } else {
+            synth.renderChannels(buses, BLOCK_FRAMES);
+            if (options.stems == RenderOptions::Stems::Files) {
+                for (size_t i = 0; i < channels.size(); ++i) {
+                    const float* bus = buses[channels[i]];
+                    int16_t* out = writers[i]->append(BLOCK_FRAMES);
+                    for (int s = 0; s < BLOCK_FRAMES * 2; ++s) {
+                        out[s] = toPcm(bus[s]);
+                    }
+                }
+            } else {
+                int16_t* out = writers[0]->append(BLOCK_FRAMES);
+                for (int f = 0; f < BLOCK_FRAMES; ++f) {
+                    for (int c : channels) {
+                        *out++ = toPcm(buses[c][f * 2]);
+                        *out++ = toPcm(buses[c][f * 2 + 1]);
+                    }
+                }
+            }
+        }
+        frames += BLOCK_FRAMES;
+
+        // After the last event, keep going until the release tails are done
+        if (player.isFinished()) {
+            if (synth.getActiveVoiceCount() == 0) {
+                break;
+            }
+            tail += BLOCK_FRAMES;
+        }
+    }
+    player.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = true;
+    for (auto& writer : writers) {
+        ok = writer->close() && ok;
+    }
+    if (!ok) {
+        return 1;
+    }
+
+    double audioSeconds = static_cast<double>(frames) / sampleRate;
+    std::printf("Rendered %.1f s of audio in %.2f s (%.1fx real time)%s\n", audioSeconds, seconds,
+                seconds > 0.0 ? audioSeconds / seconds : 0.0,
+                running.load() && !truncated ? "" : ", stopped early");
+    return 0;
+}
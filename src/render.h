@@ -0,0 +1,28 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <atomic>
+#include <string>
+
+// Offline rendering: plays a MIDI file through the synth as fast as it
+// renders and writes WAV, either the mix or one stem per MIDI channel.
+struct RenderOptions {
+    enum class Stems {
+        None,           // One stereo mix
+        Files,          // <out>.chNN.wav per channel that plays notes
+        Interleaved     // One file, a stereo pair per channel
+    };
+
+    std::string sf2Path;
+    std::string midiPath;
+    std::string outPath;          // Default: the MIDI path with .wav
+    Stems stems = Stems::None;
+    double speed = 1.0;
+    int sampleRate = 44100;
+};
+
+// Render and print a summary; running going false stops early but still
+// finishes the files (returns the process exit code)
+int runRender(const RenderOptions& options, const std::atomic<bool>& running);
+
+#endif // RENDER_H
@@ -0,0 +1,140 @@
+#include "runtime_stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+const char* const SOURCE_NAMES[RuntimeStats::SOURCE_COUNT] = {
+    "stdin", "socket", "osc", "shm", "alsa", "rawmidi", "file"
+};
+
+// Raise an atomic maximum (single writer in practice, but stay correct)
+template <typename T>
+void raiseMax(std::atomic<T>& target, T value) {
+    T current = target.load(std::memory_order_relaxed);
+    while (value > current &&
+           !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Upper edge of a histogram bucket, in microseconds
+double bucketLimitUs(int bucket) {
+    return std::exp2(static_cast<double>(bucket + 1) / RuntimeStats::BUCKETS_PER_OCTAVE);
+}
+
+// Smallest bucket limit covering `fraction` of the samples
+double percentileUs(const uint64_t* counts, uint64_t total, double fraction) {
+    if (total == 0) {
+        return 0.0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(total * fraction));
+    uint64_t seen = 0;
+    for (int i = 0; i < RuntimeStats::BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketLimitUs(i);
+        }
+    }
+    return bucketLimitUs(RuntimeStats::BUCKETS - 1);
+}
+
+} // namespace
+
+RuntimeStats::RuntimeStats() {
+    for (auto& count : events_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    for (auto& count : histogram_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    for (uint64_t& count : lastEvents_) {
+        count = 0;
+    }
+    for (uint64_t& count : lastHistogram_) {
+        count = 0;
+    }
+    startTime_ = lastTime_ = std::chrono::steady_clock::now();
+}
+
+void RuntimeStats::setRenderState(int voices, size_t scheduled) {
+    voices_.store(voices, std::memory_order_relaxed);
+    raiseMax(peakVoices_, voices);
+    scheduled_.store(scheduled, std::memory_order_relaxed);
+}
+
+void RuntimeStats::recordCallback(int64_t ns, int frames) {
+    double us = ns / 1000.0;
+    int bucket = us < 1.0 ? 0 : static_cast<int>(std::log2(us) * BUCKETS_PER_OCTAVE);
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+    histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+    callbacks_.fetch_add(1, std::memory_order_relaxed);
+    raiseMax(maxCallbackNs_, ns);
+
+    // The buffer's own duration is the deadline for producing it
+    int64_t budgetNs = static_cast<int64_t>(frames) * 1000000000LL /
+                       sampleRate_.load(std::memory_order_relaxed);
+    if (ns > budgetNs) {
+        deadlineMisses_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::string RuntimeStats::snapshotJson(const Extra& extra) {
+    std::lock_guard<std::mutex> lock(snapshotMutex_);
+
+    auto now = std::chrono::steady_clock::now();
+    double uptime = std::chrono::duration<double>(now - startTime_).count();
+    double interval = std::chrono::duration<double>(now - lastTime_).count();
+    lastTime_ = now;
+
+    // Callback times since the previous snapshot
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        uint64_t current = histogram_[i].load(std::memory_order_relaxed);
+        counts[i] = current - lastHistogram_[i];
+        lastHistogram_[i] = current;
+        total += counts[i];
+    }
+    double maxUs = maxCallbackNs_.exchange(0, std::memory_order_relaxed) / 1000.0;
+    // Bucket edges overshoot; never report a percentile above the maximum
+    double p50 = std::min(percentileUs(counts, total, 0.50), maxUs);
+    double p90 = std::min(percentileUs(counts, total, 0.90), maxUs);
+    double p99 = std::min(percentileUs(counts, total, 0.99), maxUs);
+
+    int voices = voices_.load(std::memory_order_relaxed);
+    int peakVoices = std::max(peakVoices_.exchange(0, std::memory_order_relaxed), voices);
+
+    char buf[256];
+    std::string json = "{";
+    std::snprintf(buf, sizeof(buf),
+                  "\"uptime_s\":%.1f,\"interval_s\":%.3f,\"voices\":%d,\"peak_voices\":%d,"
+                  "\"scheduled\":%zu,\"dropped_notes\":%llu,\"sample_bytes\":%zu,",
+                  uptime, interval,
+                  voices, peakVoices,
+                  scheduled_.load(std::memory_order_relaxed),
+                  static_cast<unsigned long long>(extra.droppedNotes),
+                  sampleBytes_.load(std::memory_order_relaxed));
+    json += buf;
+
+    std::snprintf(buf, sizeof(buf),
+                  "\"callbacks\":%llu,\"deadline_misses\":%llu,"
+                  "\"callback_us\":{\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f,\"max\":%.0f},",
+                  static_cast<unsigned long long>(callbacks_.load(std::memory_order_relaxed)),
+                  static_cast<unsigned long long>(deadlineMisses_.load(std::memory_order_relaxed)),
+                  p50, p90, p99, maxUs);
+    json += buf;
+
+    json += "\"events_per_sec\":{";
+    for (int i = 0; i < SOURCE_COUNT; ++i) {
+        uint64_t current = events_[i].load(std::memory_order_relaxed);
+        double rate = interval > 0.0 ? (current - lastEvents_[i]) / interval : 0.0;
+        lastEvents_[i] = current;
+        std::snprintf(buf, sizeof(buf), "%s\"%s\":%.1f", i ? "," : "", SOURCE_NAMES[i], rate);
+        json += buf;
+    }
+    json += "}}";
+    return json;
+}
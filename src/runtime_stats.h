@@ -0,0 +1,95 @@
+#ifndef RUNTIME_STATS_H
+#define RUNTIME_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Live counters for a running synth. Writers (audio callback, input threads)
+// only do relaxed atomic updates; snapshots are taken off the hot path.
+class RuntimeStats {
+public:
+    // Where events entered the synth
+    enum class Source {
+        Stdin,
+        Socket,
+        Osc,
+        Shm,
+        Alsa,
+        RawMidi,
+        File
+    };
+    static constexpr int SOURCE_COUNT = 7;
+
+    // Callback time histogram: 8 buckets per octave of microseconds
+    static constexpr int BUCKETS_PER_OCTAVE = 8;
+    static constexpr int BUCKETS = 8 * 21;   // Up to ~2 s
+
+    // Values reported on top of the counters, read without any lock
+    struct Extra {
+        uint64_t droppedNotes = 0;   // Note-ons thinned by the note filter
+    };
+
+    RuntimeStats();
+
+    void setSampleRate(int sampleRate) { sampleRate_.store(sampleRate, std::memory_order_relaxed); }
+    void setSampleBytes(size_t bytes) { sampleBytes_.store(bytes, std::memory_order_relaxed); }
+
+    // Events handed to the synth by one input
+    void countEvents(Source source, int count) {
+        events_[static_cast<int>(source)].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // Synth state after a render (audio thread)
+    void setRenderState(int voices, size_t scheduled);
+
+    // One audio callback of `frames` frames that took `ns` (audio thread)
+    void recordCallback(int64_t ns, int frames);
+
+    // Times an audio callback from construction to destruction
+    class CallbackTimer {
+    public:
+        CallbackTimer(RuntimeStats& stats, int frames)
+            : stats_(stats), frames_(frames), start_(std::chrono::steady_clock::now()) {}
+        ~CallbackTimer() {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            stats_.recordCallback(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                                  frames_);
+        }
+
+    private:
+        RuntimeStats& stats_;
+        int frames_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // One-line JSON snapshot. Rates, percentiles and peaks cover the time
+    // since the previous snapshot (or since start).
+    std::string snapshotJson(const Extra& extra);
+
+private:
+    std::atomic<int> sampleRate_{44100};
+    std::atomic<size_t> sampleBytes_{0};
+    std::atomic<uint64_t> events_[SOURCE_COUNT];
+
+    std::atomic<int> voices_{0};
+    std::atomic<int> peakVoices_{0};
+    std::atomic<size_t> scheduled_{0};
+
+    std::atomic<uint64_t> histogram_[BUCKETS];
+    std::atomic<uint64_t> callbacks_{0};
+    std::atomic<uint64_t> deadlineMisses_{0};
+    std::atomic<int64_t> maxCallbackNs_{0};
+
+    // Previous snapshot, for interval figures
+    std::mutex snapshotMutex_;
+    std::chrono::steady_clock::time_point startTime_;
+    std::chrono::steady_clock::time_point lastTime_;
+    uint64_t lastEvents_[SOURCE_COUNT];
+    uint64_t lastHistogram_[BUCKETS];
+};
+
+#endif // RUNTIME_STATS_H
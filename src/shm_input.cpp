@@ -0,0 +1,141 @@
+#include "shm_input.h"
+#include "termux_midi_shm.h"
+#include "midi_event.h"
+#include "synth.h"
+#include "trace.h"
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <sys/stat.h>
+
+namespace {
+
+// True if path is missing or holds a ring left by an earlier run, which is
+// safe to replace. Anything else may be a user's file named by --shm.
+bool replaceableRing(const char* path) {
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size != static_cast<off_t>(sizeof(tmidi_shm_ring))) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    uint32_t magic = 0;
+    ssize_t n = pread(fd, &magic, sizeof(magic), 0);
+    close(fd);
+    return n == sizeof(magic) && magic == TMIDI_SHM_MAGIC;
+}
+
+} // namespace
+
+ShmInput::ShmInput(Synthesizer& synth)
+    : synth_(synth) {
+}
+
+ShmInput::~ShmInput() {
+    stop();
+}
+
+bool ShmInput::start(const std::string& name) {
+    if (ring_) {
+        return false;
+    }
+
+    char path[512];
+    if (tmidi_shm_path(name.c_str(), path, sizeof(path)) < 0) {
+        std::fprintf(stderr, "Shared memory name too long: %s\n", name.c_str());
+        return false;
+    }
+
+    // Start from a fresh file so a stale client mapping cannot alias it
+    if (!replaceableRing(path)) {
+        std::fprintf(stderr, "%s exists and is not a shared-memory ring; not replacing it\n", path);
+        return false;
+    }
+    unlink(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        std::fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(tmidi_shm_ring)) < 0) {
+        std::fprintf(stderr, "Failed to size %s: %s\n", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    void* mem = mmap(nullptr, sizeof(tmidi_shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        std::fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        unlink(path);
+        return false;
+    }
+
+    // The file is zero-filled, so head and tail start equal
+    ring_ = static_cast<tmidi_shm_ring*>(mem);
+    ring_->capacity = TMIDI_SHM_CAPACITY;
+    ring_->version = TMIDI_SHM_VERSION;
+    __atomic_store_n(&ring_->magic, TMIDI_SHM_MAGIC, __ATOMIC_RELEASE);
+    path_ = path;
+
+    std::printf("Shared memory ring: %s\n", path);
+    return true;
+}
+
+void ShmInput::stop() {
+    if (ring_) {
+        munmap(ring_, sizeof(tmidi_shm_ring));
+        ring_ = nullptr;
+    }
+    if (!path_.empty()) {
+        unlink(path_.c_str());
+        path_.clear();
+    }
+}
+
+void ShmInput::drain() {
+    if (!ring_) {
+        return;
+    }
+
+    uint32_t tail = ring_->tail;
+    uint32_t head = __atomic_load_n(&ring_->head, __ATOMIC_ACQUIRE);
+    if (head - tail > TMIDI_SHM_CAPACITY) {
+        // Client wrote a bogus head; drop everything rather than read garbage
+        __atomic_store_n(&ring_->tail, head, __ATOMIC_RELEASE);
+        return;
+    }
+
+    MidiEvent events[DRAIN_CHUNK];
+    while (tail != head) {
+        int count = 0;
+        while (tail != head && count < DRAIN_CHUNK) {
+            const tmidi_shm_record& rec = ring_->records[tail & (TMIDI_SHM_CAPACITY - 1)];
+            ++tail;
+            if (rec.status < 0x80 || rec.status >= 0xF0) {
+                continue;  // Not a channel message
+            }
+            MidiEvent& ev = events[count++];
+            ev.time = 0.0;
+            ev.type = rec.status & 0xF0;
+            ev.channel = rec.status & 0x0F;
+            ev.param1 = rec.data1 & 0x7F;
+            ev.param2 = rec.data2 & 0x7F;
+        }
+        if (count > 0) {
+            Trace::instant("shm.events", count);
+            synth_.applyEvents(events, count);
+            synth_.stats().countEvents(RuntimeStats::Source::Shm, count);
+        }
+    }
+
+    // Hand the slots back to the client
+    __atomic_store_n(&ring_->tail, tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,38 @@
+#ifndef SHM_INPUT_H
+#define SHM_INPUT_H
+
+#include <string>
+
+class Synthesizer;
+struct tmidi_shm_ring;
+
+// Shared-memory MIDI input (see termux_midi_shm.h for the client side).
+// There is no input thread: the audio callback calls drain() right before
+// rendering, so events land in the next buffer without any system call.
+class ShmInput {
+public:
+    ShmInput(Synthesizer& synth);
+    ~ShmInput();
+
+    // Create the ring; an existing ring of the same name is replaced
+    bool start(const std::string& name);
+
+    // Unmap and remove the ring
+    void stop();
+
+    // Check if a ring is mapped
+    bool isRunning() const { return ring_ != nullptr; }
+
+    // Apply everything the client has published (audio thread)
+    void drain();
+
+    // Records applied per applyEvents() call while draining
+    static constexpr int DRAIN_CHUNK = 256;
+
+private:
+    Synthesizer& synth_;
+    tmidi_shm_ring* ring_ = nullptr;
+    std::string path_;
+};
+
+#endif // SHM_INPUT_H
@@ -13,98 +13,777 @@
 #include "../vendor/stb_vorbis.c"
 
 #include "synth.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <map>
 
-Synthesizer::Synthesizer() = default;
+// Keys and velocities are split into zones at every region boundary, so all
+// notes in a zone cell match exactly the same regions. Each distinct set is
+// stored as a contiguous copy of its regions, which a note-on swaps in as
+// the preset's region list.
+struct Synthesizer::RegionIndex {
+    uint8_t keyZone[128];
+    uint8_t velZone[128];
+    int velZones = 0;                  // 0 = preset not indexed
+    std::vector<uint32_t> cellSet;     // keyZone * velZones + velZone -> set
+    std::vector<uint32_t> setStart;    // Set -> first region (sets + 1 entries)
+    std::vector<tsf_region> regions;   // Voices point here while they play
+};
+
+Synthesizer::Synthesizer() {
+    scheduled_.reserve(MAX_SCHEDULED);
+    claimedVoices_.reserve(CLAIMED_VOICES_RESERVE);
+}
 
 Synthesizer::~Synthesizer() {
+    closeSoundFontLocked();
+}
+
+void Synthesizer::closeSoundFontLocked() {
     if (tsf_) {
+        // The last instance to close frees the shared table through tsf_->presets
+        if (sharedPresets_) {
+            tsf_->presets = sharedPresets_;
+        }
         tsf_close(tsf_);
+        tsf_ = nullptr;
     }
+    sharedPresets_ = nullptr;
+    presetTable_.clear();
+    presetLookup_.clear();
+    regionIndex_.reset();
+    voiceNodes_.clear();
+    channelVoices_.clear();
+    keyVoices_.clear();
 }
 
 bool Synthesizer::loadSoundFont(const std::string& path) {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    if (tsf_) {
-        tsf_close(tsf_);
-        tsf_ = nullptr;
-    }
-
+    closeSoundFontLocked();
     tsf_ = tsf_load_filename(path.c_str());
     if (!tsf_) {
         std::fprintf(stderr, "Failed to load soundfont: %s\n", path.c_str());
         return false;
     }
 
+    // First preset wins on duplicates, as with tsf_get_presetindex
+    presetLookup_.reserve(tsf_->presetNum);
+    for (int i = 0; i < tsf_->presetNum; ++i) {
+        uint32_t key = (static_cast<uint32_t>(tsf_->presets[i].bank) << 16) | tsf_->presets[i].preset;
+        presetLookup_.emplace(key, i);
+    }
+    buildRegionIndex();
+
     // Set output mode: stereo interleaved
-    tsf_set_output(tsf_, TSF_STEREO_INTERLEAVED, sampleRate_, 0.0f);
+    tsf_set_output(tsf_, TSF_STEREO_INTERLEAVED, sampleRate_, gainDb_);
+    tsf_->voiceClaimed = onVoiceClaimed;
+    tsf_->voiceClaimedUser = this;
+
+    // TSF keeps no sample count; region ends are clamped to the sample pool
+    unsigned int poolEnd = 0;
+    for (int i = 0; i < tsf_->presetNum; ++i) {
+        const tsf_preset& preset = tsf_->presets[i];
+        for (int r = 0; r < preset.regionNum; ++r) {
+            poolEnd = std::max(poolEnd, preset.regions[r].end);
+        }
+    }
+    stats_.setSampleBytes(poolEnd * sizeof(float));
 
     return true;
 }
 
-void Synthesizer::setOutput(int sampleRate, int /*channels*/) {
+bool Synthesizer::shareSoundFont(Synthesizer& source) {
+    if (&source == this) {
+        return isLoaded();
+    }
     std::lock_guard<std::mutex> lock(mutex_);
-    sampleRate_ = sampleRate;
+    std::lock_guard<std::mutex> sourceLock(source.mutex_);
 
-    if (tsf_) {
-        tsf_set_output(tsf_, TSF_STEREO_INTERLEAVED, sampleRate, 0.0f);
+    closeSoundFontLocked();
+    if (!source.tsf_) {
+        std::fprintf(stderr, "No soundfont loaded to share\n");
+        return false;
     }
+    tsf_ = tsf_copy(source.tsf_);
+    if (!tsf_) {
+        std::fprintf(stderr, "Failed to share soundfont\n");
+        return false;
+    }
+
+    // Region pointers in the copied table still lead to the shared regions
+    sharedPresets_ = source.sharedPresets_ ? source.sharedPresets_ : source.tsf_->presets;
+    presetTable_.assign(sharedPresets_, sharedPresets_ + tsf_->presetNum);
+    tsf_->presets = presetTable_.data();
+    presetLookup_ = source.presetLookup_;
+    regionIndex_ = source.regionIndex_;
+    tsf_set_output(tsf_, TSF_STEREO_INTERLEAVED, sampleRate_, gainDb_);
+    tsf_->voiceClaimed = onVoiceClaimed;
+    tsf_->voiceClaimedUser = this;
+    return true;
 }
 
-void Synthesizer::noteOn(int channel, int note, float velocity) {
+void Synthesizer::setGain(float gain) {
     std::lock_guard<std::mutex> lock(mutex_);
+    gainDb_ = tsf_gainToDecibels(gain);
     if (tsf_) {
-        tsf_channel_note_on(tsf_, channel, note, velocity);
+        tsf_->globalGainDB = gainDb_;
     }
 }
 
-void Synthesizer::noteOff(int channel, int note) {
+void Synthesizer::setOutput(int sampleRate, int /*channels*/) {
     std::lock_guard<std::mutex> lock(mutex_);
+    sampleRate_ = sampleRate;
+    clock_.sampleRate = sampleRate;
+    filter_.setSampleRate(sampleRate);
+    stats_.setSampleRate(sampleRate);
+
     if (tsf_) {
-        tsf_channel_note_off(tsf_, channel, note);
+        tsf_set_output(tsf_, TSF_STEREO_INTERLEAVED, sampleRate, gainDb_);
     }
 }
 
-void Synthesizer::controlChange(int channel, int controller, int value) {
+int Synthesizer::getSampleRate() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (tsf_) {
-        tsf_channel_midi_control(tsf_, channel, controller, value);
-    }
+    return sampleRate_;
+}
+
+void Synthesizer::setNoteFilter(const NoteFilter::Config& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    filter_.configure(config, sampleRate_);
+}
+
+void Synthesizer::noteOn(int channel, int note, float velocity) {
+    TraceSpan span("synth.noteOn");
+    auto lock = lockTraced();
+    noteOnLocked(channel, note, velocity);
+}
+
+void Synthesizer::noteOff(int channel, int note) {
+    TraceSpan span("synth.noteOff");
+    auto lock = lockTraced();
+    noteOffLocked(channel, note);
+}
+
+void Synthesizer::controlChange(int channel, int controller, int value) {
+    TraceSpan span("synth.controlChange");
+    auto lock = lockTraced();
+    controlChangeLocked(channel, controller, value);
 }
 
 void Synthesizer::programChange(int channel, int program) {
+    TraceSpan span("synth.programChange");
+    auto lock = lockTraced();
+    programChangeLocked(channel, program);
+}
+
+void Synthesizer::pitchBend(int channel, int value) {
+    TraceSpan span("synth.pitchBend");
+    auto lock = lockTraced();
+    pitchBendLocked(channel, value);
+}
+
+void Synthesizer::applyEvents(const MidiEvent* events, int count) {
+    TraceSpan span("synth.applyEvents", count);
+    auto lock = lockTraced();
+    for (int i = 0; i < count; ++i) {
+        applyEventLocked(events[i]);
+    }
+}
+
+void Synthesizer::scheduleEvents(const MidiEvent* events, int count) {
+    TraceSpan span("synth.scheduleEvents", count);
+    auto lock = lockTraced();
+    auto earlier = [](const MidiEvent& a, const MidiEvent& b) { return a.time < b.time; };
+
+    for (int i = 0; i < count; ++i) {
+        if (scheduled_.size() == MAX_SCHEDULED && scheduledHead_ > 0) {
+            scheduled_.erase(scheduled_.begin(), scheduled_.begin() + scheduledHead_);
+            scheduledHead_ = 0;
+        }
+        if (scheduled_.size() == MAX_SCHEDULED) {
+            applyEventLocked(events[i]);  // Queue full: play now rather than never
+            continue;
+        }
+        // Events mostly arrive in time order, so this is usually an append;
+        // upper_bound keeps equal times in arrival order
+        auto pos = std::upper_bound(scheduled_.begin() + scheduledHead_, scheduled_.end(),
+                                    events[i], earlier);
+        scheduled_.insert(pos, events[i]);
+    }
+}
+
+std::unique_lock<std::mutex> Synthesizer::lockTraced() {
+    TraceSpan wait("synth.lock");
+    return std::unique_lock<std::mutex>(mutex_);
+}
+
+Synthesizer::Clock Synthesizer::getClock() const {
     std::lock_guard<std::mutex> lock(mutex_);
+    return clock_;
+}
+
+void Synthesizer::applyEventLocked(const MidiEvent& ev) {
+    switch (ev.type) {
+        case MIDI_NOTE_ON:
+            if (ev.param2 > 0) {
+                noteOnLocked(ev.channel, ev.param1, ev.param2 / 127.0f);
+            } else {
+                noteOffLocked(ev.channel, ev.param1);
+            }
+            break;
+
+        case MIDI_NOTE_OFF:
+            noteOffLocked(ev.channel, ev.param1);
+            break;
+
+        case MIDI_CONTROL_CHANGE:
+            controlChangeLocked(ev.channel, ev.param1, ev.param2);
+            break;
+
+        case MIDI_PROGRAM_CHANGE:
+            programChangeLocked(ev.channel, ev.param1);
+            break;
+
+        case MIDI_PITCH_BEND:
+            pitchBendLocked(ev.channel, ev.pitchBend());
+            break;
+
+        default:
+            // Aftertouch is not supported by TSF
+            break;
+    }
+}
+
+void Synthesizer::noteOnLocked(int channel, int note, float velocity) {
+    if (filter_.enabled()) {
+        bool accept = velocity > 0.0f
+            ? filter_.acceptNoteOn(channel, note, static_cast<int>(velocity * 127.0f + 0.5f))
+            : filter_.acceptNoteOff(channel, note);
+        if (!accept) {
+            return;
+        }
+    }
+    if (!tsf_) {
+        return;
+    }
+    if (velocity <= 0.0f) {
+        releaseKeyLocked(channel, note);
+        return;
+    }
+    unsigned int playIndex = tsf_->voicePlayIndex;
+    claimedVoices_.clear();
+    if (!noteOnIndexed(channel, note, velocity)) {
+        tsf_channel_note_on(tsf_, channel, note, velocity);
+    }
+    if (!claimedVoices_.empty()) {
+        linkVoices(channel, note, playIndex);
+    }
+}
+
+void Synthesizer::noteOffLocked(int channel, int note) {
+    if (filter_.enabled() && !filter_.acceptNoteOff(channel, note)) {
+        return;
+    }
     if (tsf_) {
-        tsf_channel_set_presetnumber(tsf_, channel, program, channel == 9);
+        releaseKeyLocked(channel, note);
     }
 }
 
-void Synthesizer::pitchBend(int channel, int value) {
-    std::lock_guard<std::mutex> lock(mutex_);
+void Synthesizer::controlChangeLocked(int channel, int controller, int value) {
+    // Any controller brings the channel up, as in tsf_channel_midi_control
+    if (!tsf_ || !tsf_channel_init(tsf_, channel)) {
+        return;
+    }
+    switch (controller) {
+        case 120:   // All sound off
+            forEachChannelVoice(channel, [this](tsf_voice& v) {
+                if (v.ampenv.segment < TSF_SEGMENT_RELEASE || v.ampenv.parameters.release) {
+                    tsf_voice_endquick(tsf_, &v);
+                }
+            });
+            break;
+
+        case 123:   // All notes off, ignoring sustain
+            forEachChannelVoice(channel, [this](tsf_voice& v) {
+                if (v.ampenv.segment < TSF_SEGMENT_RELEASE) {
+                    tsf_voice_end(tsf_, &v);
+                }
+            });
+            break;
+
+        default:
+            changeChannelLocked(channel, [&](tsf_channel& c) {
+                setChannelController(c, controller, value);
+            });
+            break;
+    }
+}
+
+// The channel half of tsf_channel_midi_control: updates the channel state
+// only, changeChannelLocked carries it over to the voices
+void Synthesizer::setChannelController(tsf_channel& c, int controller, int value) {
+    // 14-bit controllers: MSB below 32, LSB at MSB + 32
+    auto withHalf = [&](unsigned int field) {
+        return static_cast<unsigned short>(controller < 32 ? (field & 0x7F) | (value << 7)
+                                                           : (field & 0x3F80) | value);
+    };
+    switch (controller) {
+        case 7: case 39: case 11: case 43:
+            if (controller == 7 || controller == 39) {
+                c.midiVolume = withHalf(c.midiVolume);
+            } else {
+                c.midiExpression = withHalf(c.midiExpression);
+            }
+            // Cubed, as in TSF, for a usable volume curve
+            c.gainDB = tsf_gainToDecibels(TSF_POWF((c.midiVolume / 16383.0f) * (c.midiExpression / 16383.0f), 3.0f));
+            break;
+
+        case 10: case 42:
+            c.midiPan = withHalf(c.midiPan);
+            c.panOffset = c.midiPan / 16383.0f - 0.5f;
+            break;
+
+        case 6: case 38:    // Data entry for the selected RPN
+            c.midiData = withHalf(c.midiData);
+            if (c.midiRPN == 0) {
+                c.pitchRange = (c.midiData >> 7) + 0.01f * (c.midiData & 0x7F);
+            } else if (c.midiRPN == 1) {   // Fine tuning
+                c.tuning = static_cast<int>(c.tuning) + (static_cast<float>(c.midiData) - 8192.0f) / 8192.0f;
+            } else if (c.midiRPN == 2 && controller == 6) {   // Coarse tuning
+                c.tuning = (static_cast<float>(value) - 64.0f) + (c.tuning - static_cast<int>(c.tuning));
+            }
+            break;
+
+        case 0:     // Bank select MSB alone acts like LSB
+            c.bank = static_cast<unsigned short>(0x8000 | value);
+            break;
+
+        case 32:
+            c.bank = static_cast<unsigned short>((c.bank & 0x8000 ? ((c.bank & 0x7F) << 7) : 0) | value);
+            break;
+
+        case 101:
+            c.midiRPN = static_cast<unsigned short>(((c.midiRPN == 0xFFFF ? 0 : c.midiRPN) & 0x7F) | (value << 7));
+            break;
+
+        case 100:
+            c.midiRPN = static_cast<unsigned short>(((c.midiRPN == 0xFFFF ? 0 : c.midiRPN) & 0x3F80) | value);
+            break;
+
+        case 98: case 99:   // NRPNs aren't supported
+            c.midiRPN = 0xFFFF;
+            break;
+
+        case 64:
+            c.sustain = value >= 64;
+            break;
+
+        case 121:   // Reset all controllers
+            c.midiVolume = c.midiExpression = 16383;
+            c.midiPan = 8192;
+            c.bank = 0;
+            c.midiRPN = 0xFFFF;
+            c.midiData = 0;
+            c.gainDB = 0.0f;
+            c.panOffset = 0.0f;
+            c.pitchRange = 2.0f;
+            c.tuning = 0.0f;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void Synthesizer::onVoiceClaimed(void* user, int voice) {
+    static_cast<Synthesizer*>(user)->claimedVoices_.push_back(voice);
+}
+
+void Synthesizer::linkVoices(int channel, int key, unsigned int playIndex) {
+    // Link the voices TSF reported for this note-on
+    voiceNodes_.resize(tsf_->voiceNum);
+    if (channel >= static_cast<int>(channelVoices_.size())) {
+        channelVoices_.resize(channel + 1, -1);
+        keyVoices_.resize((channel + 1) * 128, -1);
+    }
+    bool keyed = key >= 0 && key < 128;
+    for (int i : claimedVoices_) {
+        unlinkVoice(i);
+        VoiceNode& node = voiceNodes_[i];
+        node.channel = channel;
+        node.playIndex = playIndex;
+        node.prev = -1;
+        node.next = channelVoices_[channel];
+        if (node.next != -1) voiceNodes_[node.next].prev = i;
+        channelVoices_[channel] = i;
+        if (keyed) {
+            int& head = keyVoices_[channel * 128 + key];
+            node.key = key;
+            node.keyPrev = -1;
+            node.keyNext = head;
+            if (node.keyNext != -1) voiceNodes_[node.keyNext].keyPrev = i;
+            head = i;
+        }
+    }
+}
+
+void Synthesizer::unlinkVoice(int voice) {
+    VoiceNode& node = voiceNodes_[voice];
+    if (node.channel == -1) {
+        return;
+    }
+    if (node.prev != -1) voiceNodes_[node.prev].next = node.next;
+    else channelVoices_[node.channel] = node.next;
+    if (node.next != -1) voiceNodes_[node.next].prev = node.prev;
+
+    if (node.key != -1) {
+        if (node.keyPrev != -1) voiceNodes_[node.keyPrev].keyNext = node.keyNext;
+        else keyVoices_[node.channel * 128 + node.key] = node.keyNext;
+        if (node.keyNext != -1) voiceNodes_[node.keyNext].keyPrev = node.keyPrev;
+    }
+    node = VoiceNode();
+}
+
+// A node is stale once its voice stopped or was claimed by a newer note-on
+template <typename Fn>
+void Synthesizer::forEachChannelVoice(int channel, Fn fn) {
+    if (channel < 0 || channel >= static_cast<int>(channelVoices_.size())) {
+        return;
+    }
+    for (int i = channelVoices_[channel]; i != -1;) {
+        int next = voiceNodes_[i].next;
+        tsf_voice& v = tsf_->voices[i];
+        if (v.playingPreset == -1 || v.playIndex != voiceNodes_[i].playIndex) {
+            unlinkVoice(i);
+        } else {
+            fn(v);
+        }
+        i = next;
+    }
+}
+
+template <typename Fn>
+void Synthesizer::forEachKeyVoice(int channel, int key, Fn fn) {
+    if (channel < 0 || channel >= static_cast<int>(channelVoices_.size())) {
+        return;
+    }
+    for (int i = keyVoices_[channel * 128 + key]; i != -1;) {
+        int next = voiceNodes_[i].keyNext;
+        tsf_voice& v = tsf_->voices[i];
+        if (v.playingPreset == -1 || v.playIndex != voiceNodes_[i].playIndex) {
+            unlinkVoice(i);
+        } else {
+            fn(v);
+        }
+        i = next;
+    }
+}
+
+// Lets change() update the channel state, then carries the change over to
+// that channel's voices the way TSF's channel setters do.
+template <typename Fn>
+void Synthesizer::changeChannelLocked(int channel, Fn change) {
+    tsf_channel* c = tsf_channel_init(tsf_, channel);
+    if (!c) {
+        return;
+    }
+    tsf_channel before = *c;
+    change(*c);
+
+    float gainChange = c->gainDB - before.gainDB;
+    bool pan = c->panOffset != before.panOffset;
+    bool pitch = c->pitchWheel != before.pitchWheel || c->pitchRange != before.pitchRange ||
+                 c->tuning != before.tuning;
+    bool sustainOff = before.sustain && !c->sustain;
+    if (gainChange == 0.0f && !pan && !pitch && !sustainOff) {
+        return;
+    }
+
+    float pitchShift = c->pitchWheel == 8192
+        ? c->tuning
+        : (c->pitchWheel / 16383.0f * c->pitchRange * 2.0f) - c->pitchRange + c->tuning;
+    forEachChannelVoice(channel, [&](tsf_voice& v) {
+        v.noteGainDB += gainChange;
+        if (pan) {
+            float newpan = v.region->pan + c->panOffset;
+            if      (newpan <= -0.5f) { v.panFactorLeft = 1.0f; v.panFactorRight = 0.0f; }
+            else if (newpan >=  0.5f) { v.panFactorLeft = 0.0f; v.panFactorRight = 1.0f; }
+            else { v.panFactorLeft = TSF_SQRTF(0.5f - newpan); v.panFactorRight = TSF_SQRTF(0.5f + newpan); }
+        }
+        if (pitch) {
+            tsf_voice_calcpitchratio(&v, pitchShift, tsf_->outSampleRate);
+        }
+        // Releasing the pedal ends the notes it was holding
+        if (sustainOff && v.ampenv.segment < TSF_SEGMENT_RELEASE && v.heldSustain) {
+            tsf_voice_end(tsf_, &v);
+        }
+    });
+}
+
+void Synthesizer::releaseKeyLocked(int channel, int key) {
+    if (key < 0 || key > 127) {
+        tsf_channel_note_off(tsf_, channel, key);
+        return;
+    }
+
+    // Like tsf_channel_note_off, release only the oldest held note-on
+    bool found = false;
+    unsigned int oldest = 0;
+    forEachKeyVoice(channel, key, [&](tsf_voice& v) {
+        if (v.ampenv.segment < TSF_SEGMENT_RELEASE && !v.heldSustain &&
+            (!found || v.playIndex < oldest)) {
+            oldest = v.playIndex;
+            found = true;
+        }
+    });
+    if (!found) {
+        return;
+    }
+    bool sustain = tsf_->channels->channels[channel].sustain;
+    forEachKeyVoice(channel, key, [&](tsf_voice& v) {
+        if (v.playIndex != oldest || v.ampenv.segment >= TSF_SEGMENT_RELEASE || v.heldSustain) {
+            return;
+        }
+        if (sustain) {
+            v.heldSustain = 1;   // Ended when the pedal comes up
+        } else {
+            tsf_voice_end(tsf_, &v);
+        }
+    });
+}
+
+void Synthesizer::buildRegionIndex() {
+    regionIndex_ = std::make_shared<std::vector<RegionIndex>>(tsf_->presetNum);
+    for (int p = 0; p < tsf_->presetNum; ++p) {
+        const tsf_preset& preset = tsf_->presets[p];
+        if (preset.regionNum < REGION_INDEX_MIN) {
+            continue;
+        }
+        RegionIndex& index = (*regionIndex_)[p];
+
+        // Zone edges: 0 and every region's low end and high end + 1
+        bool keyEdge[129] = {true};
+        bool velEdge[129] = {true};
+        for (int r = 0; r < preset.regionNum; ++r) {
+            const tsf_region& region = preset.regions[r];
+            keyEdge[std::min<int>(region.lokey, 128)] = true;
+            keyEdge[std::min<int>(region.hikey + 1, 128)] = true;
+            velEdge[std::min<int>(region.lovel, 128)] = true;
+            velEdge[std::min<int>(region.hivel + 1, 128)] = true;
+        }
+        int keyZones = 0, velZones = 0;
+        int keyFirst[128], velFirst[128];   // First key/velocity of each zone
+        for (int i = 0; i < 128; ++i) {
+            if (keyEdge[i]) keyFirst[keyZones++] = i;
+            if (velEdge[i]) velFirst[velZones++] = i;
+            index.keyZone[i] = static_cast<uint8_t>(keyZones - 1);
+            index.velZone[i] = static_cast<uint8_t>(velZones - 1);
+        }
+
+        // One region set per cell; identical sets share storage
+        std::map<std::vector<int>, uint32_t> sets;
+        std::vector<int> matches;
+        index.velZones = velZones;
+        index.cellSet.resize(keyZones * velZones);
+        index.setStart.push_back(0);
+        for (int kz = 0; kz < keyZones; ++kz) {
+            for (int vz = 0; vz < velZones; ++vz) {
+                int key = keyFirst[kz], vel = velFirst[vz];
+                matches.clear();
+                for (int r = 0; r < preset.regionNum; ++r) {
+                    const tsf_region& region = preset.regions[r];
+                    if (key >= region.lokey && key <= region.hikey &&
+                        vel >= region.lovel && vel <= region.hivel) {
+                        matches.push_back(r);
+                    }
+                }
+                auto inserted = sets.emplace(matches, static_cast<uint32_t>(sets.size()));
+                if (inserted.second) {
+                    for (int r : matches) {
+                        index.regions.push_back(preset.regions[r]);
+                    }
+                    index.setStart.push_back(static_cast<uint32_t>(index.regions.size()));
+                }
+                index.cellSet[kz * velZones + vz] = inserted.first->second;
+            }
+        }
+    }
+}
+
+bool Synthesizer::noteOnIndexed(int channel, int note, float velocity) {
+    if (!tsf_->channels || channel >= tsf_->channels->channelNum || note < 0 || note > 127) {
+        return false;
+    }
+    int presetIndex = tsf_->channels->channels[channel].presetIndex;
+    if (!regionIndex_ || presetIndex >= static_cast<int>(regionIndex_->size()) ||
+        !(*regionIndex_)[presetIndex].velZones) {
+        return false;
+    }
+    RegionIndex& index = (*regionIndex_)[presetIndex];
+
+    // Same rounding as tsf_note_on
+    int midiVelocity = static_cast<short>(velocity * 127);
+    if (midiVelocity < 1 || midiVelocity > 127) {
+        return false;
+    }
+
+    uint32_t set = index.cellSet[index.keyZone[note] * index.velZones + index.velZone[midiVelocity]];
+    tsf_preset& preset = tsf_->presets[presetIndex];
+    tsf_region* regions = preset.regions;
+    int regionNum = preset.regionNum;
+    preset.regions = index.regions.data() + index.setStart[set];
+    preset.regionNum = static_cast<int>(index.setStart[set + 1] - index.setStart[set]);
+    tsf_channel_note_on(tsf_, channel, note, velocity);
+    preset.regions = regions;
+    preset.regionNum = regionNum;
+    return true;
+}
+
+int Synthesizer::findPreset(int bank, int program) const {
+    auto it = presetLookup_.find((static_cast<uint32_t>(bank & 0xFFFF) << 16) | (program & 0xFFFF));
+    return it != presetLookup_.end() ? it->second : -1;
+}
+
+void Synthesizer::programChangeLocked(int channel, int program) {
+    if (!tsf_) {
+        return;
+    }
+    tsf_channel* c = tsf_channel_init(tsf_, channel);
+    if (!c) {
+        return;
+    }
+
+    // Same fallbacks as tsf_channel_set_presetnumber, with hashed lookups.
+    // Channel 10 of every 16-channel block is the drum channel.
+    int bank = c->bank & 0x7FFF;
+    int index;
+    if (channel % 16 == 9) {
+        index = findPreset(128 | bank, program);
+        if (index == -1) index = findPreset(128, program);
+        if (index == -1) index = findPreset(128, 0);
+        if (index == -1) index = findPreset(bank, program);
+    } else {
+        index = findPreset(bank, program);
+    }
+    if (index == -1) index = findPreset(0, program);
+
+    if (index != -1) {
+        c->presetIndex = static_cast<unsigned short>(index);
+    }
+}
+
+void Synthesizer::pitchBendLocked(int channel, int value) {
     if (tsf_) {
-        // Convert 0-16383 to -1.0 to 1.0 (semitones based on pitch bend range)
-        float bend = (value - 8192) / 8192.0f;
-        tsf_channel_set_pitchwheel(tsf_, channel, value);
-        (void)bend; // pitch wheel handles it internally
+        // Value is 0-16383 with 8192 as center; TSF applies the bend range
+        changeChannelLocked(channel, [&](tsf_channel& c) {
+            c.pitchWheel = static_cast<unsigned short>(value);
+        });
     }
 }
 
 void Synthesizer::allNotesOff() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    TraceSpan span("synth.allNotesOff");
+    auto lock = lockTraced();
+    filter_.reset();
     if (tsf_) {
         tsf_note_off_all(tsf_);
     }
 }
 
-void Synthesizer::render(int16_t* buffer, int frames) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (tsf_) {
-        tsf_render_short(tsf_, buffer, frames, 0);
-    } else {
-        std::memset(buffer, 0, frames * 2 * sizeof(int16_t));
+void Synthesizer::beginRenderLocked(int frames) {
+    clock_.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    clock_.frame = renderFrame_;
+    clock_.blockFrames = frames;
+}
+
+int Synthesizer::nextSliceLocked(int done, int frames) {
+    // The slice ends where the next scheduled event is due
+    int slice = frames - done;
+    while (scheduledHead_ < scheduled_.size()) {
+        double due = scheduled_[scheduledHead_].time - static_cast<double>(renderFrame_ + done);
+        if (due >= 1.0) {
+            slice = std::min(slice, static_cast<int>(due));
+            break;
+        }
+        applyEventLocked(scheduled_[scheduledHead_++]);
+    }
+    if (scheduledHead_ == scheduled_.size()) {
+        scheduled_.clear();
+        scheduledHead_ = 0;
     }
+    return slice;
+}
+
+void Synthesizer::endRenderLocked(int frames) {
+    renderFrame_ += frames;
+    if (filter_.enabled()) {
+        filter_.advance(frames);
+    }
+
+    stats_.setRenderState(tsf_ ? tsf_active_voice_count(tsf_) : 0, scheduled_.size() - scheduledHead_);
+}
+
+void Synthesizer::render(int16_t* buffer, int frames, bool mix) {
+    TraceSpan span("synth.render", frames);
+    auto lock = lockTraced();
+    beginRenderLocked(frames);
+
+    int done = 0;
+    while (done < frames) {
+        int slice = nextSliceLocked(done, frames);
+        if (tsf_) {
+            tsf_render_short(tsf_, buffer + done * 2, slice, mix ? 1 : 0);
+        } else if (!mix) {
+            std::memset(buffer + done * 2, 0, slice * 2 * sizeof(int16_t));
+        }
+        done += slice;
+    }
+
+    endRenderLocked(frames);
+}
+
+void Synthesizer::renderChannels(float* const* buses, int frames) {
+    TraceSpan span("synth.render", frames);
+    auto lock = lockTraced();
+    beginRenderLocked(frames);
+
+    for (int c = 0; c < STEM_CHANNELS; ++c) {
+        std::memset(buses[c], 0, frames * 2 * sizeof(float));
+    }
+
+    // Same pieces as tsf_render_short, so voice envelopes and LFOs advance
+    // exactly as they do in a mixed render
+    const int block = TSF_RENDER_SHORTBUFFERBLOCK / 2;
+    int done = 0;
+    while (done < frames) {
+        int slice = nextSliceLocked(done, frames);
+        for (int start = 0; tsf_ && start < slice; start += block) {
+            int n = std::min(block, slice - start);
+            tsf_voice* v = tsf_->voices;
+            tsf_voice* end = v + tsf_->voiceNum;
+            for (; v != end; ++v) {
+                if (v->playingPreset != -1) {
+                    float* bus = buses[v->playingChannel % STEM_CHANNELS];
+                    tsf_voice_render(tsf_, v, bus + (done + start) * 2, n);
+                }
+            }
+        }
+        done += slice;
+    }
+
+    endRenderLocked(frames);
+}
+
+std::string Synthesizer::getStatsJson() {
+    NoteFilter::Stats filtered = filter_.getStats();
+    RuntimeStats::Extra extra;
+    extra.droppedNotes = filtered.belowFloor + filtered.overCap;
+    return stats_.snapshotJson(extra);
 }
 
 std::vector<std::string> Synthesizer::getInstruments() const {
@@ -139,3 +818,32 @@ std::string Synthesizer::getPresetName(int index) const {
     }
     return "";
 }
+
+int Synthesizer::getActiveVoiceCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tsf_ ? tsf_active_voice_count(tsf_) : 0;
+}
+
+Synthesizer::PresetInfo Synthesizer::getPresetInfo(int index) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PresetInfo info;
+    if (!tsf_ || index < 0 || index >= tsf_->presetNum) {
+        return info;
+    }
+
+    const tsf_preset& preset = tsf_->presets[index];
+    info.bank = preset.bank;
+    info.program = preset.preset;
+    info.regions = preset.regionNum;
+    for (int i = 0; i < preset.regionNum; ++i) {
+        const tsf_region& region = preset.regions[i];
+        // Same test TSF uses to switch its voice low-pass on
+        if (region.initialFilterFc <= 13500 || region.modLfoToFilterFc || region.modEnvToFilterFc) {
+            ++info.filteredRegions;
+        }
+        if (region.loop_mode != TSF_LOOPMODE_NONE) {
+            ++info.loopedRegions;
+        }
+    }
+    return info;
+}
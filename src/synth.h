@@ -1,12 +1,19 @@
 #ifndef SYNTH_H
 #define SYNTH_H
 
+#include "midi_event.h"
+#include "note_filter.h"
+#include "runtime_stats.h"
+#include <memory>
 #include <string>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
 // Forward declare TSF
 struct tsf;
+struct tsf_preset;
+struct tsf_channel;
 
 class Synthesizer {
 public:
@@ -19,8 +26,27 @@ public:
     // Check if loaded
     bool isLoaded() const { return tsf_ != nullptr; }
 
-    // Set output mode (stereo interleaved, 44100Hz)
+    // Use the soundfont loaded in source without loading it again: samples,
+    // regions and lookups are shared (tsf_copy), while channels and voices
+    // are this instance's own. source must stay loaded while this one starts.
+    bool shareSoundFont(Synthesizer& source);
+
+    // Output gain for notes started from now on (1.0 = unchanged)
+    void setGain(float gain);
+
+    // Set output mode (stereo interleaved at sampleRate)
     void setOutput(int sampleRate, int channels);
+    int getSampleRate() const;
+
+    // Thin out dense note-on streams (disabled by default)
+    void setNoteFilter(const NoteFilter::Config& config);
+    NoteFilter::Stats getNoteFilterStats() const { return filter_.getStats(); }
+
+    // Live counters shared by the audio callback and every input
+    RuntimeStats& stats() { return stats_; }
+
+    // One-line JSON snapshot of the live counters (see RuntimeStats)
+    std::string getStatsJson();
 
     // MIDI events (thread-safe)
     void noteOn(int channel, int note, float velocity);
@@ -30,8 +56,36 @@ public:
     void pitchBend(int channel, int value);
     void allNotesOff();
 
-    // Render audio (called from audio thread)
-    void render(int16_t* buffer, int frames);
+    // Apply a batch of channel messages under a single lock
+    void applyEvents(const MidiEvent* events, int count);
+
+    // Queue channel messages for sample-accurate playback. Each event's
+    // time is the absolute render frame it takes effect at; render() splits
+    // its block there. Events already in the past apply at the next block.
+    void scheduleEvents(const MidiEvent* events, int count);
+
+    // Position of the render clock, for mapping external timestamps
+    struct Clock {
+        uint64_t frame = 0;    // First frame of the last render() call
+        int64_t timeNs = 0;    // steady_clock time when that call started
+        int blockFrames = 0;   // Frames rendered by that call
+        int sampleRate = 44100;
+    };
+    Clock getClock() const;
+
+    static constexpr size_t MAX_SCHEDULED = 4096;
+
+    // Render audio (called from audio thread); with mix, add to the buffer
+    // instead of overwriting it
+    void render(int16_t* buffer, int frames, bool mix = false);
+
+    // Render each MIDI channel's voices into its own bus instead of one mix:
+    // buses[c] receives channel c as interleaved stereo floats (frames * 2),
+    // from the same single pass over the voices. Summing the buses gives the
+    // mix render() would produce. Channels above 15 (serve --ports) fold onto
+    // channel % 16.
+    static constexpr int STEM_CHANNELS = 16;
+    void renderChannels(float* const* buses, int frames);
 
     // Get instrument list
     std::vector<std::string> getInstruments() const;
@@ -40,10 +94,92 @@ public:
     int getPresetCount() const;
     std::string getPresetName(int index) const;
 
+    // Get number of voices currently sounding
+    int getActiveVoiceCount() const;
+
+    // Bank/program and region make-up of a preset
+    struct PresetInfo {
+        int bank = 0;
+        int program = 0;
+        int regions = 0;
+        int filteredRegions = 0;   // Regions with a low-pass filter engaged
+        int loopedRegions = 0;     // Regions that sustain by looping
+    };
+    PresetInfo getPresetInfo(int index) const;
+
 private:
     tsf* tsf_ = nullptr;
     mutable std::mutex mutex_;
     int sampleRate_ = 44100;
+    float gainDb_ = 0.0f;
+    NoteFilter filter_;
+    RuntimeStats stats_;
+    Clock clock_;
+    uint64_t renderFrame_ = 0;          // Next frame render() will produce
+    std::vector<MidiEvent> scheduled_;  // Sorted by time, consumed from scheduledHead_
+    size_t scheduledHead_ = 0;
+
+    // (bank << 16 | program) -> preset index, built at load so program
+    // changes don't scan every preset like tsf_get_presetindex does
+    std::unordered_map<uint32_t, int> presetLookup_;
+    int findPreset(int bank, int program) const;
+
+    // Per-preset key/velocity zones listing the regions a note-on matches,
+    // so tsf_note_on only walks those instead of every region
+    struct RegionIndex;
+    std::shared_ptr<std::vector<RegionIndex>> regionIndex_;   // Shared with clones
+    static constexpr int REGION_INDEX_MIN = 8;   // Smaller presets scan directly
+    void buildRegionIndex();
+    bool noteOnIndexed(int channel, int note, float velocity);
+
+    // A clone swaps region sets into its own copy of the preset table, so
+    // instances sharing a soundfont never touch each other's presets
+    std::vector<tsf_preset> presetTable_;
+    tsf_preset* sharedPresets_ = nullptr;   // The shared table, restored before tsf_close
+    void closeSoundFontLocked();
+
+    // Intrusive per-channel and per-channel/key lists threaded through
+    // TSF's voice pool, so note-off, sustain and controller changes only
+    // visit the voices they affect. Voices TSF ends on its own are unlinked
+    // when a walk finds them gone. TSF reports the voices each note-on claims
+    // through its voiceClaimed hook (vendor/tsf.h).
+    struct VoiceNode {
+        int prev = -1, next = -1;         // Channel list
+        int keyPrev = -1, keyNext = -1;   // Channel/key list
+        int channel = -1;                 // -1 when unlinked
+        int key = -1;                     // -1 when not in a key list
+        unsigned int playIndex = 0;       // Note-on that claimed the voice
+    };
+    std::vector<VoiceNode> voiceNodes_;   // Parallel to TSF's voice array
+    std::vector<int> channelVoices_;      // Channel -> first node
+    std::vector<int> keyVoices_;          // channel * 128 + key -> first node
+    std::vector<int> claimedVoices_;      // Voices the current note-on claimed
+    static constexpr size_t CLAIMED_VOICES_RESERVE = 64;
+    static void onVoiceClaimed(void* user, int voice);
+    void linkVoices(int channel, int key, unsigned int playIndex);
+    void unlinkVoice(int voice);
+    template <typename Fn> void forEachChannelVoice(int channel, Fn fn);
+    template <typename Fn> void forEachKeyVoice(int channel, int key, Fn fn);
+    template <typename Fn> void changeChannelLocked(int channel, Fn change);
+    static void setChannelController(tsf_channel& c, int controller, int value);
+    void releaseKeyLocked(int channel, int key);
+
+    // Take mutex_; with --trace the wait shows up as a "synth.lock" span
+    std::unique_lock<std::mutex> lockTraced();
+
+    // Shared by render() and renderChannels(), caller must hold mutex_:
+    // apply events due at done and return the frames until the next one
+    void beginRenderLocked(int frames);
+    int nextSliceLocked(int done, int frames);
+    void endRenderLocked(int frames);
+
+    // Event handlers, caller must hold mutex_
+    void applyEventLocked(const MidiEvent& ev);
+    void noteOnLocked(int channel, int note, float velocity);
+    void noteOffLocked(int channel, int note);
+    void controlChangeLocked(int channel, int controller, int value);
+    void programChangeLocked(int channel, int program);
+    void pitchBendLocked(int channel, int value);
 };
 
 #endif // SYNTH_H
@@ -0,0 +1,135 @@
+/*
+ * termux-midi shared-memory client API (C and C++)
+ *
+ * `termux-midi listen --shm <name>` creates a single-producer,
+ * single-consumer ring of 4-byte MIDI records. One client process writes
+ * records; the synth drains them at the start of every audio buffer.
+ * Writing is a memory store plus one atomic release, with no system call.
+ *
+ *     struct tmidi_shm_ring* ring = tmidi_shm_attach("synth");
+ *     tmidi_shm_send(ring, 0x90, 60, 100);
+ *     tmidi_shm_detach(ring);
+ *
+ * Only one writer may be attached at a time.
+ */
+#ifndef TERMUX_MIDI_SHM_H
+#define TERMUX_MIDI_SHM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TMIDI_SHM_MAGIC     0x44494D54u  /* "TMID" */
+#define TMIDI_SHM_VERSION   1u
+#define TMIDI_SHM_CAPACITY  4096u        /* Records, power of two */
+
+/* Same layout as the binary socket protocol: status, data1, data2, 0 */
+struct tmidi_shm_record {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t reserved;
+};
+
+struct tmidi_shm_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    /* Free-running counters on separate cache lines */
+    uint8_t pad0[48];
+    uint32_t head;                       /* Written by the client */
+    uint8_t pad1[60];
+    uint32_t tail;                       /* Written by the synth */
+    uint8_t pad2[60];
+    struct tmidi_shm_record records[TMIDI_SHM_CAPACITY];
+};
+
+/*
+ * Resolve a ring name to a file path. Names containing '/' are used as
+ * paths; otherwise the file lives in /dev/shm, or in $TMPDIR where there
+ * is no /dev/shm (Android).
+ */
+static inline int tmidi_shm_path(const char* name, char* path, size_t size) {
+    const char* dir;
+    struct stat st;
+    if (strchr(name, '/')) {
+        return snprintf(path, size, "%s", name) < (int)size ? 0 : -1;
+    }
+    if (stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode)) {
+        dir = "/dev/shm";
+    } else if ((dir = getenv("TMPDIR")) == NULL || dir[0] == '\0') {
+        dir = "/data/data/com.termux/files/usr/tmp";
+    }
+    return snprintf(path, size, "%s/termux-midi-%s", dir, name) < (int)size ? 0 : -1;
+}
+
+/* Map the ring created by the synth (NULL on failure) */
+static inline struct tmidi_shm_ring* tmidi_shm_attach(const char* name) {
+    char path[512];
+    struct tmidi_shm_ring* ring;
+    int fd;
+
+    if (tmidi_shm_path(name, path, sizeof(path)) < 0) {
+        return NULL;
+    }
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    ring = (struct tmidi_shm_ring*)mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+    if (ring->magic != TMIDI_SHM_MAGIC || ring->version != TMIDI_SHM_VERSION ||
+        ring->capacity != TMIDI_SHM_CAPACITY) {
+        munmap(ring, sizeof(*ring));
+        return NULL;
+    }
+    return ring;
+}
+
+static inline void tmidi_shm_detach(struct tmidi_shm_ring* ring) {
+    if (ring) {
+        munmap(ring, sizeof(*ring));
+    }
+}
+
+/*
+ * Append records and publish them together, so they reach the synth in
+ * the same audio buffer. All or nothing: returns 0 if the ring is too full.
+ */
+static inline int tmidi_shm_write(struct tmidi_shm_ring* ring,
+                                  const struct tmidi_shm_record* records, uint32_t count) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t i;
+
+    if (count > TMIDI_SHM_CAPACITY - (head - tail)) {
+        return 0;
+    }
+    for (i = 0; i < count; ++i) {
+        ring->records[(head + i) & (TMIDI_SHM_CAPACITY - 1)] = records[i];
+    }
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline int tmidi_shm_send(struct tmidi_shm_ring* ring,
+                                 uint8_t status, uint8_t data1, uint8_t data2) {
+    struct tmidi_shm_record record;
+    record.status = status;
+    record.data1 = data1;
+    record.data2 = data2;
+    record.reserved = 0;
+    return tmidi_shm_write(ring, &record, 1);
+}
+
+#endif /* TERMUX_MIDI_SHM_H */
@@ -0,0 +1,141 @@
+#include "thread_policy.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+ThreadPolicy::Config ThreadPolicy::config_;
+bool ThreadPolicy::enabled_ = false;
+
+namespace {
+
+// Fallback when SCHED_FIFO is refused: Android's THREAD_PRIORITY_URGENT_AUDIO
+// and THREAD_PRIORITY_AUDIO
+constexpr int RENDER_NICE = -19;
+constexpr int INPUT_NICE = -16;
+
+// "4,6-7"
+bool parseCpuList(const std::string& text, std::vector<int>& cpus) {
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string item = text.substr(pos, end - pos);
+        char* rest = nullptr;
+        long first = std::strtol(item.c_str(), &rest, 10);
+        long last = first;
+        if (rest == item.c_str()) {
+            return false;
+        }
+        if (*rest == '-') {
+            const char* from = rest + 1;
+            last = std::strtol(from, &rest, 10);
+            if (rest == from) {
+                return false;
+            }
+        }
+        if (*rest != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        pos = end + 1;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+std::string formatCpuList(const std::vector<int>& cpus) {
+    std::string text;
+    for (int cpu : cpus) {
+        if (!text.empty()) {
+            text += ',';
+        }
+        text += std::to_string(cpu);
+    }
+    return text;
+}
+
+} // namespace
+
+void ThreadPolicy::configure(const Config& config) {
+    config_ = config;
+    enabled_ = config.rtPriority > 0 || !config.renderCpus.empty() || !config.inputCpus.empty();
+}
+
+bool ThreadPolicy::parseAffinity(const std::string& text, Config& config) {
+    std::vector<int> render;
+    std::vector<int> input;
+    size_t colon = text.find(':');
+    if (!parseCpuList(text.substr(0, colon), render)) {
+        return false;
+    }
+    if (colon == std::string::npos) {
+        input = render;
+    } else if (!parseCpuList(text.substr(colon + 1), input)) {
+        return false;
+    }
+    config.renderCpus = render;
+    config.inputCpus = input;
+    return true;
+}
+
+void ThreadPolicy::apply(Role role, const char* name) {
+    thread_local bool applied = false;
+    if (!enabled_ || applied) {
+        return;
+    }
+    applied = true;
+
+    const bool render = role == Role::Render;
+    std::string report;
+    char text[128];
+
+    // Input threads one step below the render thread, so a burst of events
+    // can't hold off the callback that consumes them
+    if (config_.rtPriority > 0) {
+        sched_param param{};
+        param.sched_priority = render ? config_.rtPriority : std::max(1, config_.rtPriority - 1);
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err == 0) {
+            std::snprintf(text, sizeof(text), "SCHED_FIFO priority %d", param.sched_priority);
+        } else {
+            // With who = 0, Linux changes the nice value of the calling thread only
+            int nice = render ? RENDER_NICE : INPUT_NICE;
+            if (setpriority(PRIO_PROCESS, 0, nice) == 0) {
+                std::snprintf(text, sizeof(text), "SCHED_FIFO not permitted (%s), nice %d",
+                              std::strerror(err), nice);
+            } else {
+                std::snprintf(text, sizeof(text), "SCHED_FIFO and nice %d not permitted (%s), default scheduling",
+                              nice, std::strerror(errno));
+            }
+        }
+        report += text;
+    }
+
+    const std::vector<int>& cpus = render ? config_.renderCpus : config_.inputCpus;
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        if (!report.empty()) {
+            report += ", ";
+        }
+        report += "CPUs " + formatCpuList(cpus);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            report += std::string(" not permitted (") + std::strerror(errno) + "), any CPU";
+        }
+    }
+
+    std::fprintf(stderr, "Thread %s: %s\n", name, report.c_str());
+}
@@ -0,0 +1,44 @@
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <string>
+#include <vector>
+
+// Scheduling for the latency-critical threads (--rt-priority, --cpu-affinity).
+// Each thread applies the policy to itself as it starts; the audio thread on
+// its first callback, since OpenSL ES owns it. SCHED_FIFO falls back to a
+// raised nice level, and that to default scheduling, when not permitted.
+// Every thread reports what it got on stderr.
+class ThreadPolicy {
+public:
+    enum class Role {
+        Render,     // Audio callback, offline rendering
+        Input       // Threads feeding events to the synth
+    };
+
+    struct Config {
+        int rtPriority = 0;              // SCHED_FIFO priority for Render (Input
+                                         // gets one less); 0 = don't change
+        std::vector<int> renderCpus;     // Empty = any CPU
+        std::vector<int> inputCpus;
+    };
+
+    static constexpr int MAX_RT_PRIORITY = 99;
+
+    // Set the policy (before the threads start)
+    static void configure(const Config& config);
+
+    // Apply the policy to the calling thread; later calls on the same
+    // thread do nothing
+    static void apply(Role role, const char* name);
+
+    // Parse "<cpus>[:<input cpus>]", where cpus is a list such as "4,6-7";
+    // without the second list input threads use the same CPUs
+    static bool parseAffinity(const std::string& text, Config& config);
+
+private:
+    static Config config_;
+    static bool enabled_;
+};
+
+#endif // THREAD_POLICY_H
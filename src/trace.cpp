@@ -0,0 +1,148 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+std::atomic<bool> Trace::enabled_{false};
+
+namespace {
+
+struct Record {
+    const char* name;
+    int64_t startNs;
+    int64_t durationNs;   // -1 for instant events
+    int count;
+};
+
+// One thread's events. Only the owning thread writes; head is published
+// with release so write() sees complete records.
+struct ThreadRing {
+    int tid = 0;
+    const char* name = nullptr;
+    std::atomic<uint64_t> head{0};
+    std::unique_ptr<Record[]> records{new Record[Trace::RING_SIZE]};
+
+    void push(const char* eventName, int64_t startNs, int64_t durationNs, int count) {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        Record& r = records[index & (Trace::RING_SIZE - 1)];
+        r.name = eventName;
+        r.startNs = startNs;
+        r.durationNs = durationNs;
+        r.count = count;
+        head.store(index + 1, std::memory_order_release);
+    }
+};
+
+// Allocated up front by enable() and kept until exit, so write() can still
+// read threads that finished. Records are left uninitialised: the pages of
+// rings no thread claims are never touched.
+std::unique_ptr<ThreadRing[]> g_rings;
+std::atomic<int> g_claimed{0};
+thread_local ThreadRing* t_ring = nullptr;
+
+} // namespace
+
+void Trace::enable() {
+    if (!g_rings) {
+        g_rings.reset(new ThreadRing[MAX_THREADS]);
+        for (int i = 0; i < MAX_THREADS; ++i) {
+            g_rings[i].tid = i + 1;
+        }
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+int64_t Trace::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::registerThread(const char* name) {
+    if (!enabled() || t_ring) {
+        return;
+    }
+    int index = g_claimed.load(std::memory_order_relaxed);
+    while (index < MAX_THREADS &&
+           !g_claimed.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {
+    }
+    if (index >= MAX_THREADS) {
+        return;
+    }
+    g_rings[index].name = name;
+    t_ring = &g_rings[index];
+}
+
+void Trace::instant(const char* name, int count) {
+    if (enabled() && t_ring) {
+        t_ring->push(name, nowNs(), -1, count);
+    }
+}
+
+void Trace::complete(const char* name, int64_t startNs, int count) {
+    if (enabled() && t_ring) {
+        t_ring->push(name, startNs, nowNs() - startNs, count);
+    }
+}
+
+bool Trace::write(const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        std::fprintf(stderr, "Failed to open trace file: %s\n", path.c_str());
+        return false;
+    }
+
+    // Rings claimed after this point only miss the events they record later
+    const int claimed = std::min(g_claimed.load(std::memory_order_acquire), MAX_THREADS);
+
+    // Timestamps relative to the earliest retained event. Spans are pushed
+    // when they end, so rings are ordered by end time, not start time.
+    int64_t origin = INT64_MAX;
+    for (int index = 0; index < claimed; ++index) {
+        const ThreadRing* ring = &g_rings[index];
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            origin = std::min(origin, ring->records[i & (RING_SIZE - 1)].startNs);
+        }
+    }
+
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"termux-midi\"}}");
+    size_t events = 0;
+    for (int index = 0; index < claimed; ++index) {
+        const ThreadRing* ring = &g_rings[index];
+        if (ring->name) {
+            std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                            "\"args\":{\"name\":\"%s\"}}", ring->tid, ring->name);
+        }
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            const Record& r = ring->records[i & (RING_SIZE - 1)];
+            double ts = (r.startNs - origin) / 1000.0;
+            if (r.durationNs < 0) {
+                std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                             r.name, ts, ring->tid);
+            } else {
+                std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+                             r.name, ts, r.durationNs / 1000.0, ring->tid);
+            }
+            if (r.count >= 0) {
+                std::fprintf(f, ",\"args\":{\"count\":%d}", r.count);
+            }
+            std::fputc('}', f);
+            ++events;
+        }
+    }
+    std::fprintf(f, "\n]}\n");
+
+    bool ok = std::fclose(f) == 0;
+    if (!ok) {
+        std::fprintf(stderr, "Failed to write trace file: %s\n", path.c_str());
+    } else {
+        std::printf("Trace written: %s (%zu events)\n", path.c_str(), events);
+    }
+    return ok;
+}
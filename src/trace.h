@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timeline recording for --trace. Each thread appends spans and instant
+// events to its own lock-free ring; write() dumps them all in Chrome Trace
+// Event format (open in Perfetto or chrome://tracing). When tracing is off
+// every hook costs a single relaxed load.
+class Trace {
+public:
+    // Events kept per thread; older ones are overwritten
+    static constexpr int RING_SIZE = 1 << 16;
+
+    // Threads that can be traced; the rings are allocated by enable()
+    static constexpr int MAX_THREADS = 32;
+
+    // Start recording (call before the threads to trace are started)
+    static void enable();
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // Give the calling thread a ring, labelled name, before its loop
+    // starts. Claiming a ring neither locks nor allocates, so the audio
+    // thread can register in its first callback. Events from threads that
+    // never registered (or once all rings are taken) are dropped.
+    static void registerThread(const char* name);
+
+    // Point event with an optional count (names must be string literals)
+    static void instant(const char* name, int count = -1);
+
+    // Span from startNs to now
+    static void complete(const char* name, int64_t startNs, int count = -1);
+
+    static int64_t nowNs();
+
+    // Write every thread's events to a JSON file
+    static bool write(const std::string& path);
+
+private:
+    static std::atomic<bool> enabled_;
+};
+
+// Records the enclosing scope as a span; end() closes it early
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, int count = -1)
+        : name_(name), count_(count), startNs_(Trace::enabled() ? Trace::nowNs() : 0) {}
+    ~TraceSpan() { end(); }
+
+    void setCount(int count) { count_ = count; }
+
+    void end() {
+        if (startNs_) {
+            Trace::complete(name_, startNs_, count_);
+            startNs_ = 0;
+        }
+    }
+
+private:
+    const char* name_;
+    int count_;
+    int64_t startNs_;
+};
+
+#endif // TRACE_H